@@ -0,0 +1,138 @@
+#include "grid.hpp"
+#include "marching_cubes/marching_cubes.hpp"
+#include "timing.hpp"
+#include "vof/boundary.hpp"
+#include "vof/normals.hpp"
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+/*
+Row-major vs brick layout, on marching cubes and on the normals of VOF (its
+widest stencil, 27 points), both reading cells through grid[idxs]. Also
+reports the cost of the conversions between the layouts, marching cubes
+skipping the uniform blocks of a BlockSummary, and marching cubes with an
+indexed mesh, which must expand to the same triangles (in another order).
+Usage: bench-layout [size] [repetitions]
+*/
+int main(int argc, char** argv) {
+    using namespace waves_on_cuda::marching_cubes;
+    const std::size_t n = argc > 1 ? std::atol(argv[1]) : 128;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 3;
+    const std::array<std::size_t, 3> shape = {n, n, n};
+    Grid<double, 3> row_major(shape), round_trip(shape);
+    BrickGrid<double, 3> bricks(shape);
+    // A wavy surface, smeared over a few cells
+    for(const auto& [i, j, k]: row_major.indices()) {
+        const double height =
+            n * (0.5 + 0.1 * std::sin(0.2 * i) * std::cos(0.15 * j));
+        row_major[{i, j, k}] = std::clamp(height - k, 0.0, 1.0);
+    }
+
+    auto report = [&](const char* name, auto&& f) {
+        f(); // warm-up
+        const auto t1 = timer_clock::now();
+        for(int r = 0; r < repetitions; r++) f();
+        const std::chrono::duration<double, std::milli> runtime =
+            timer_clock::now() - t1;
+        const double ms = runtime.count() / repetitions;
+        std::cout << name << "," << row_major.size() << "," << ms << ","
+                  << row_major.size() / ms / 1e3 << std::endl;
+    };
+    auto normals = [&](const auto& grid) {
+        double sum = 0;
+        for(const auto& idxs: grid.indices()) {
+            const auto normal =
+                mixed_young_centered([&](int di, int dj, int dk) {
+                    return grid[{WallBoundary::neighbour(idxs[0], di, n),
+                                 WallBoundary::neighbour(idxs[1], dj, n),
+                                 WallBoundary::neighbour(idxs[2], dk, n)}];
+                });
+            sum += normal[0] + normal[1] + normal[2];
+        }
+        return sum;
+    };
+
+    std::cout << "#benchmark,cells,time[ms],Mcells/s" << std::endl;
+    report("to bricks", [&]() { bricks.assign(row_major); });
+    report("to row-major", [&]() { bricks.copy_to(round_trip); });
+    double normals_row_major, normals_bricks;
+    report("normals row-major",
+           [&]() { normals_row_major = normals(row_major); });
+    report("normals bricks", [&]() { normals_bricks = normals(bricks); });
+    std::vector<geometry::Triangle<float>> triangles_row_major,
+        triangles_bricks;
+    report("marching cubes row-major",
+           [&]() { triangles_row_major = marching_cubes(row_major, 0.5); });
+    report("marching cubes bricks",
+           [&]() { triangles_bricks = marching_cubes(bricks, 0.5); });
+    BlockSummary blocks(shape);
+    report("block summary", [&]() {
+        for(std::size_t b = 0; b < blocks.nb_blocks(); b++)
+            blocks.update_fraction(row_major, b);
+    });
+    std::vector<geometry::Triangle<float>> triangles_blocks;
+    std::size_t skipped = 0;
+    report("marching cubes skipping blocks", [&]() {
+        triangles_blocks = marching_cubes(row_major, 0.5, blocks, &skipped);
+    });
+    std::cout << "#skipped " << skipped << " of " << blocks.nb_blocks()
+              << " blocks" << std::endl;
+    geometry::IndexedMesh<float> mesh;
+    report("marching cubes indexed",
+           [&]() { mesh = marching_cubes_indexed(row_major, 0.5); });
+    const std::size_t soup_bytes = triangles_row_major.size() *
+                                   sizeof(geometry::Triangle<float>);
+    const std::size_t indexed_bytes =
+        mesh.vertices.size() * sizeof(mesh.vertices[0]) +
+        mesh.indices.size() * sizeof(mesh.indices[0]);
+    std::cout << "#mesh of " << triangles_row_major.size() << " triangles: "
+              << soup_bytes << " bytes, indexed " << mesh.vertices.size()
+              << " vertices " << indexed_bytes << " bytes" << std::endl;
+
+    for(const auto& idxs: row_major.indices()) {
+        if(round_trip[idxs] != row_major[idxs]) {
+            std::cerr << "Round trip differs" << std::endl;
+            return 1;
+        }
+    }
+    if(normals_row_major != normals_bricks or
+       triangles_row_major.size() != triangles_bricks.size() or
+       triangles_row_major.size() != triangles_blocks.size() or
+       mesh.indices.size() != 3 * triangles_row_major.size()) {
+        std::cerr << "Results differ" << std::endl;
+        return 1;
+    }
+    for(std::size_t t = 0; t < triangles_row_major.size(); t++) {
+        for(int c = 0; c < 3; c++) {
+            const auto& a = triangles_row_major[t].corners[c];
+            for(const auto* other: {&triangles_bricks, &triangles_blocks}) {
+                const auto& b = (*other)[t].corners[c];
+                if(a.x != b.x or a.y != b.y or a.z != b.z) {
+                    std::cerr << "Triangle " << t << " differs" << std::endl;
+                    return 1;
+                }
+            }
+        }
+    }
+    // The indexed triangles are in another order
+    using Corners = std::array<float, 9>;
+    std::vector<Corners> soup, indexed;
+    for(std::size_t t = 0; t < triangles_row_major.size(); t++) {
+        Corners& a = soup.emplace_back();
+        Corners& b = indexed.emplace_back();
+        for(int c = 0; c < 3; c++) {
+            const auto& p = triangles_row_major[t].corners[c];
+            const auto& q = mesh.vertices[mesh.indices[3 * t + c]];
+            a[3 * c] = p.x, a[3 * c + 1] = p.y, a[3 * c + 2] = p.z;
+            b[3 * c] = q.x, b[3 * c + 1] = q.y, b[3 * c + 2] = q.z;
+        }
+    }
+    std::sort(soup.begin(), soup.end());
+    std::sort(indexed.begin(), indexed.end());
+    if(soup != indexed) {
+        std::cerr << "Indexed triangles differ" << std::endl;
+        return 1;
+    }
+}
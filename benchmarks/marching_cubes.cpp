@@ -0,0 +1,153 @@
+#include "grid.hpp"
+#include "marching_cubes/marching_cubes.hpp"
+#include "thread_pool.hpp"
+#include "timing.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <span>
+#include <vector>
+
+/*
+Scaling of marching cubes by slabs with the number of threads, on a sphere
+filling most of the grid, against the serial marching cubes, and the two-pass
+marching cubes. The slabs must give the same triangles as the serial version,
+in the same order, for every thread count, and the two passes too. Then times re-meshing with IncrementalMesher when a small blob
+appears or goes on the surface.
+Usage: bench-marching-cubes [size] [repetitions] [threads...]
+*/
+int main(int argc, char** argv) {
+    using namespace waves_on_cuda::marching_cubes;
+    using Triangles = std::vector<geometry::Triangle<float>>;
+    const std::size_t n = argc > 1 ? std::atol(argv[1]) : 256;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 3;
+    std::vector<unsigned int> nthreads;
+    for(int i = 3; i < argc; i++) nthreads.push_back(std::atoi(argv[i]));
+    if(nthreads.empty())
+        nthreads = {1, 2, 4, 8};
+
+    // Volume fraction of a sphere, smeared over a cell
+    Grid<double, 3> grid({n, n, n});
+    const double center = 0.5 * (n - 1), radius = 0.4 * n;
+    for(const auto& [i, j, k]: grid.indices()) {
+        const double distance =
+            std::sqrt((i - center) * (i - center) +
+                      (j - center) * (j - center) +
+                      (k - center) * (k - center));
+        grid[{i, j, k}] = std::clamp(radius - distance + 0.5, 0.0, 1.0);
+    }
+
+    auto time = [&](auto&& f) {
+        f(); // warm-up
+        const auto t1 = timer_clock::now();
+        for(int r = 0; r < repetitions; r++) f();
+        const std::chrono::duration<double, std::milli> runtime =
+            timer_clock::now() - t1;
+        return runtime.count() / repetitions;
+    };
+    auto same = [](const geometry::Point3D<float>& a,
+                   const geometry::Point3D<float>& b) {
+        return a.x == b.x and a.y == b.y and a.z == b.z;
+    };
+
+    Triangles serial;
+    const double serial_ms =
+        time([&]() { serial = marching_cubes(grid, 0.5); });
+    std::cout << "#threads,cells,time[ms],speedup" << std::endl;
+    std::cout << "serial," << grid.size() << "," << serial_ms << ",1"
+              << std::endl;
+    const Triangles& reference = serial;
+    for(const unsigned int threads: nthreads) {
+        ThreadPool pool(threads);
+        Triangles slabs;
+        const double ms =
+            time([&]() { slabs = marching_cubes(grid, 0.5, pool); });
+        std::cout << threads << "," << grid.size() << "," << ms << ","
+                  << serial_ms / ms << std::endl;
+        bool equal = slabs.size() == reference.size();
+        for(std::size_t t = 0; equal and t < slabs.size(); t++) {
+            for(int c = 0; c < 3; c++)
+                equal = equal and same(slabs[t].corners[c],
+                                       reference[t].corners[c]);
+        }
+        if(not equal) {
+            std::cerr << "Triangles differ with " << threads << " threads"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    // Two passes into a buffer that only grows, the same triangles as the slabs
+    Triangles two_pass;
+    const double two_pass_ms = time([&]() {
+        const CubeCounts counts = count_triangles(grid, 0.5);
+        if(two_pass.size() < counts.total())
+            two_pass.resize(counts.total());
+        fill_triangles(grid, 0.5, counts,
+                       std::span(two_pass.data(), counts.total()));
+    });
+    std::cout << "two-pass," << grid.size() << "," << two_pass_ms << ","
+              << serial_ms / two_pass_ms << std::endl;
+    bool equal = two_pass.size() == reference.size();
+    for(std::size_t t = 0; equal and t < two_pass.size(); t++) {
+        for(int c = 0; c < 3; c++)
+            equal = equal and
+                    same(two_pass[t].corners[c], reference[t].corners[c]);
+    }
+    if(not equal) {
+        std::cerr << "Two-pass triangles differ" << std::endl;
+        return 1;
+    }
+    std::cout << "#" << serial.size() << " triangles" << std::endl;
+
+    // The triangles of the blocks are in another order
+    using Corners = std::array<float, 9>;
+    auto sorted = [](const Triangles& triangles) {
+        std::vector<Corners> result;
+        for(const auto& triangle: triangles) {
+            Corners& corners = result.emplace_back();
+            for(int c = 0; c < 3; c++) {
+                corners[3 * c] = triangle.corners[c].x;
+                corners[3 * c + 1] = triangle.corners[c].y;
+                corners[3 * c + 2] = triangle.corners[c].z;
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+
+    // Re-meshing after a small blob appeared or went on the surface of the
+    // sphere, the other blocks being unchanged
+    Grid<double, 3> blob({n, n, n});
+    std::copy(grid.data(), grid.data() + grid.size(), blob.data());
+    const double blob_center = center + radius, blob_radius = 0.05 * n;
+    for(const auto& [i, j, k]: blob.indices()) {
+        const double distance =
+            std::sqrt((i - center) * (i - center) +
+                      (j - center) * (j - center) +
+                      (k - blob_center) * (k - blob_center));
+        blob[{i, j, k}] = std::max(
+            blob[{i, j, k}], std::clamp(blob_radius - distance + 0.5, 0., 1.));
+    }
+    IncrementalMesher mesher(0.5);
+    mesher.update(grid);
+    std::size_t frame = 0, changed = 0;
+    const double incremental_ms = time([&]() {
+        changed = mesher.update(frame++ % 2 == 0 ? blob : grid).size();
+    });
+    std::cout << "incremental," << grid.size() << "," << incremental_ms << ","
+              << serial_ms / incremental_ms << std::endl;
+    std::cout << "#" << changed << " of " << mesher.nb_blocks()
+              << " blocks re-meshed" << std::endl;
+    Triangles blocks;
+    for(std::size_t b = 0; b < mesher.nb_blocks(); b++)
+        blocks.insert(blocks.end(), mesher.triangles(b).begin(),
+                      mesher.triangles(b).end());
+    if(sorted(blocks) !=
+       sorted(marching_cubes(frame % 2 == 0 ? grid : blob, 0.5))) {
+        std::cerr << "Incremental triangles differ" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,105 @@
+#include "grid.hpp"
+#include "timing.hpp"
+#include "vof/boundary.hpp"
+#include "vof/normals.hpp"
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+/*
+Mixed Young Centered normals of every cell of a grid of mixed cells: the
+27-point sum cell by cell (as VOF used to do it), the separable sums cell by
+cell, and the separable sums by tile.
+Usage: bench-normals [size] [repetitions]
+*/
+
+// Normal of one cell with the 27 weighted neighbours summed one by one
+template<typename F>
+std::array<double, 3> naive_mixed_young_centered(F&& volume_fraction) {
+    std::array<double, 3> normal = {0, 0, 0};
+    for(int di = -1; di <= 1; di++) {
+        for(int dj = -1; dj <= 1; dj++) {
+            for(int dk = -1; dk <= 1; dk++) {
+                const int diff = (di != 0) + (dj != 0) + (dk != 0);
+                const int coeff = diff == 1 ? 4 : diff == 2 ? 2 : 1;
+                const double cell_vf =
+                    std::clamp(volume_fraction(di, dj, dk), 0.0, 1.0);
+                normal[0] += di * cell_vf * coeff;
+                normal[1] += dj * cell_vf * coeff;
+                normal[2] += dk * cell_vf * coeff;
+            }
+        }
+    }
+    return normalize_normal(normal);
+}
+
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::atol(argv[1]) : 128;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 5;
+    const std::array<std::size_t, 3> shape = {n, n, n};
+    Grid<double, 3> vf(shape);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> mixed(0.01, 0.99);
+    for(const auto& idxs: vf.indices()) vf[idxs] = mixed(rng);
+    VectorGrid<double, 3, 3> naive(shape), separable(shape), tiled(shape);
+
+    auto neighbour = [&](const std::array<std::size_t, 3>& idxs) {
+        return [&](int di, int dj, int dk) {
+            return vf[{WallBoundary::neighbour(idxs[0], di, n),
+                       WallBoundary::neighbour(idxs[1], dj, n),
+                       WallBoundary::neighbour(idxs[2], dk, n)}];
+        };
+    };
+    auto report = [&](const char* name, auto&& f) {
+        f(); // warm-up
+        const auto t1 = timer_clock::now();
+        for(int r = 0; r < repetitions; r++) f();
+        const std::chrono::duration<double, std::milli> runtime =
+            timer_clock::now() - t1;
+        const double ms = runtime.count() / repetitions;
+        std::cout << name << "," << vf.size() << "," << ms << ","
+                  << vf.size() / ms / 1e3 << std::endl;
+    };
+
+    std::cout << "#implementation,cells,time[ms],Mcells/s" << std::endl;
+    report("naive", [&]() {
+        for(const auto& idxs: vf.indices())
+            naive[idxs] = naive_mixed_young_centered(neighbour(idxs));
+    });
+    report("separable", [&]() {
+        for(const auto& idxs: vf.indices())
+            separable[idxs] = mixed_young_centered(neighbour(idxs));
+    });
+    report("tiled", [&]() {
+        MixedYoungCenteredTile<WallBoundary> tile;
+        constexpr std::size_t size = MixedYoungCenteredTile<WallBoundary>::size;
+        for(std::size_t i = 0; i < n; i += size) {
+            for(std::size_t j = 0; j < n; j += size) {
+                for(std::size_t k = 0; k < n; k += size) {
+                    tile.load(vf, {i, j, k});
+                    for(std::size_t a = i; a < std::min(i + size, n); a++) {
+                        for(std::size_t b = j; b < std::min(j + size, n); b++) {
+                            for(std::size_t c = k; c < std::min(k + size, n);
+                                c++)
+                                tiled[{a, b, c}] = tile.normal({a, b, c});
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    // The separable sums are added in another order than the naive one
+    for(const auto& idxs: vf.indices()) {
+        for(int dim = 0; dim < 3; dim++) {
+            if(separable[idxs][dim] != tiled[idxs][dim] or
+               std::abs(separable[idxs][dim] - naive[idxs][dim]) > 1e-12) {
+                std::cerr << "Results differ at " << idxs[0] << " " << idxs[1]
+                          << " " << idxs[2] << std::endl;
+                return 1;
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#include "grid.hpp"
+#include "timing.hpp"
+#include <array>
+#include <cstdlib>
+#include <iostream>
+
+/*
+Cost per cell of a 7-point Laplacian with zero-gradient walls, iterating with
+indices() and grid[idxs] vs Stencil offsets.
+Usage: bench-stencil [size] [repetitions]
+*/
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::atol(argv[1]) : 128;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 10;
+    const std::array<std::size_t, 3> shape = {n, n, n};
+    Grid<double, 3> in(shape), out_indices(shape), out_stencil(shape);
+    for(const auto& [i, j, k]: in.indices())
+        in[i][j][k] = (i * 7 + j * 3 + k) % 11;
+
+    // Neighbour along dim, clamped to the grid
+    auto neighbour = [&](std::array<std::size_t, 3> idxs, int dim, int d) {
+        if(not(d < 0 and idxs[dim] == 0) and
+           not(d > 0 and idxs[dim] == shape[dim] - 1))
+            idxs[dim] += d;
+        return idxs;
+    };
+    auto laplacian_at = [&](const std::array<std::size_t, 3>& idxs) {
+        double result = -6 * in[idxs];
+        for(int dim = 0; dim < 3; dim++) {
+            result += in[neighbour(idxs, dim, -1)];
+            result += in[neighbour(idxs, dim, +1)];
+        }
+        return result;
+    };
+
+    auto report = [&](const char* name, auto&& f) {
+        f(); // warm-up
+        const auto t1 = timer_clock::now();
+        for(int r = 0; r < repetitions; r++) f();
+        const std::chrono::duration<double, std::nano> runtime =
+            timer_clock::now() - t1;
+        std::cout << name << "," << in.size() << ","
+                  << runtime.count() / repetitions / in.size() << std::endl;
+    };
+
+    std::cout << "#iteration,cells,time per cell[ns]" << std::endl;
+    report("indices", [&]() {
+        for(const auto& idxs: in.indices())
+            out_indices[idxs] = laplacian_at(idxs);
+    });
+    report("stencil", [&]() {
+        const Stencil<3> stencil(shape);
+        const double* data = in.data();
+        double* result = out_stencil.data();
+        const std::ptrdiff_t sx = stencil.stride(0), sy = stencil.stride(1),
+                             sz = stencil.stride(2);
+        stencil.for_each_interior(0, n, [&](std::size_t c) {
+            result[c] = -6 * data[c] + data[c - sx] + data[c + sx] +
+                        data[c - sy] + data[c + sy] + data[c - sz] +
+                        data[c + sz];
+        });
+        stencil.for_each_boundary(0, n, [&](const auto& idxs, std::size_t c) {
+            result[c] = laplacian_at(idxs);
+        });
+    });
+
+    for(std::size_t c = 0; c < in.size(); c++) {
+        if(out_indices.data()[c] != out_stencil.data()[c]) {
+            std::cerr << "Results differ at offset " << c << std::endl;
+            return 1;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#include "timing.hpp"
+#include "vof/intersect.hpp"
+#include <array>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/*
+Scalar vs batched get_wall_sizes, on random mixed cells.
+Usage: bench-wall-sizes [cells] [repetitions]
+*/
+int main(int argc, char** argv) {
+    const std::size_t n = argc > 1 ? std::atol(argv[1]) : 1 << 20;
+    const int repetitions = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<double> vf(n), normal[3], early[3], late[3];
+    for(int dim = 0; dim < 3; dim++) {
+        normal[dim].resize(n);
+        early[dim].resize(n);
+        late[dim].resize(n);
+    }
+    for(std::size_t c = 0; c < n; c++) {
+        vf[c] = std::abs(uniform(rng));
+        std::array<double, 3> cell_normal = {uniform(rng), uniform(rng),
+                                             uniform(rng)};
+        const double norm = std::sqrt(cell_normal[0] * cell_normal[0] +
+                                      cell_normal[1] * cell_normal[1] +
+                                      cell_normal[2] * cell_normal[2]);
+        for(int dim = 0; dim < 3; dim++)
+            normal[dim][c] = cell_normal[dim] / norm;
+    }
+
+    auto report = [&](const char* name, auto&& f) {
+        f(); // warm-up
+        const auto t1 = timer_clock::now();
+        for(int r = 0; r < repetitions; r++) f();
+        const std::chrono::duration<double, std::milli> runtime =
+            timer_clock::now() - t1;
+        const double ms = runtime.count() / repetitions;
+        std::cout << name << "," << n << "," << ms << ","
+                  << n / ms / 1e3 << std::endl;
+    };
+
+    std::cout << "#implementation,cells,time[ms],Mcells/s" << std::endl;
+    report("scalar", [&]() {
+        for(std::size_t c = 0; c < n; c++) {
+            std::array<double, 3> cell_normal = {normal[0][c], normal[1][c],
+                                                 normal[2][c]};
+            const auto [cell_early, cell_late] =
+                get_wall_sizes(vf[c], cell_normal);
+            for(int dim = 0; dim < 3; dim++) {
+                early[dim][c] = cell_early[dim];
+                late[dim][c] = cell_late[dim];
+            }
+        }
+    });
+    report(wall_sizes_instruction_set(), [&]() {
+        get_wall_sizes(vf, {normal[0], normal[1], normal[2]},
+                       {early[0], early[1], early[2]},
+                       {late[0], late[1], late[2]});
+    });
+}
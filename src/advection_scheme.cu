@@ -72,6 +72,11 @@ void UpwindScheme::step(const ::Grid<double, 2>& before,
     t += dt;
 }
 
+// The Courant number c of step() must not exceed 1
+double UpwindScheme::max_stable_dt(const UpwindScheme::Grid& grid) const {
+    return 1.0 / (WAVE_SPEED * grid.shape()[0]);
+}
+
 void UpwindScheme::multi_step(unsigned int N, UpwindScheme::Grid& before,
                               UpwindScheme::Grid& after, double t,
                               double dt) const {
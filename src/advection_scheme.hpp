@@ -9,4 +9,5 @@ public:
               double dt) const override;
     void multi_step(unsigned int N, Grid& before, Grid& after, double t,
                     double dt) const override;
+    double max_stable_dt(const Grid& grid) const override;
 };
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/*
+Bump allocator for buffers that all die at the same time, e.g. the temporaries
+of one time step.
+Memory comes from the upstream allocator in blocks, which are kept by reset().
+Allocations are served from the blocks in order, so once a cycle (between two
+resets) has run, any cycle that allocates the same sizes in the same order
+never touches the upstream allocator again.
+Not thread-safe: allocate from a single thread.
+*/
+template<typename Upstream = std::allocator<std::byte>>
+class Arena {
+    using traits = std::allocator_traits<Upstream>;
+
+    struct Block {
+        std::byte* data;
+        std::size_t size;
+    };
+    Upstream upstream;
+    std::vector<Block> blocks;
+    // Position of the next allocation
+    std::size_t current_block = 0, offset = 0;
+    std::size_t live_allocations = 0, upstream_allocations = 0;
+
+    static constexpr std::size_t min_block_size = 1 << 20;
+
+public:
+    Arena() = default;
+    Arena(const Arena&) = delete;
+    ~Arena() {
+        assert(live_allocations == 0);
+        for(const Block& block: blocks) {
+            traits::deallocate(upstream, block.data, block.size);
+        }
+    }
+
+    void* allocate(std::size_t bytes, std::size_t alignment) {
+        for(; current_block < blocks.size(); current_block++, offset = 0) {
+            const Block& block = blocks[current_block];
+            const std::size_t start = (offset + alignment - 1) / alignment *
+                                      alignment;
+            if(start + bytes <= block.size) {
+                offset = start + bytes;
+                live_allocations++;
+                return block.data + start;
+            }
+        }
+        // Grow geometrically, so that a cycle needs few blocks
+        const std::size_t size =
+            std::max({bytes + alignment, min_block_size, capacity()});
+        blocks.push_back({traits::allocate(upstream, size), size});
+        upstream_allocations++;
+        // Upstream allocators return memory aligned for any scalar type
+        assert(reinterpret_cast<std::uintptr_t>(blocks.back().data) %
+                   alignment ==
+               0);
+        offset = bytes;
+        live_allocations++;
+        return blocks.back().data;
+    }
+
+    // Memory is only reclaimed by reset()
+    void deallocate(void*) {
+        assert(live_allocations > 0);
+        live_allocations--;
+    }
+
+    // Make all the memory available again. Everything allocated since the
+    // last reset must have been deallocated.
+    void reset() {
+        assert(live_allocations == 0);
+        current_block = 0;
+        offset = 0;
+    }
+
+    std::size_t capacity() const {
+        std::size_t result = 0;
+        for(const Block& block: blocks) result += block.size;
+        return result;
+    }
+    // Number of blocks requested from the upstream allocator so far
+    std::size_t nb_upstream_allocations() const {
+        return upstream_allocations;
+    }
+};
+
+// Allocator interface to an Arena. Like CUDAAllocator, hands out zeroed memory.
+template<typename T, typename Upstream = std::allocator<std::byte>>
+struct ArenaAllocator {
+    using value_type = T;
+    Arena<Upstream>* arena;
+
+    ArenaAllocator(Arena<Upstream>& arena): arena(&arena) {
+    }
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U, Upstream>& other)
+        : arena(other.arena) {
+    }
+
+    T* allocate(std::size_t n) {
+        void* mem = arena->allocate(n * sizeof(T), alignof(T));
+        std::memset(mem, 0, n * sizeof(T));
+        return static_cast<T*>(mem);
+    }
+
+    void deallocate(T* ptr, std::size_t /*n*/) {
+        // Moved-from grids deallocate a null pointer
+        if(ptr)
+            arena->deallocate(ptr);
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U, Upstream>& other) const {
+        return arena == other.arena;
+    }
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "grid.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/*
+Coarse summary of a staggered grid by blocks of block_size^3 cells (smaller
+on the last blocks of each axis): the range of the volume fraction of the
+cells of each block, and the largest speed on their faces. Passes that do
+nothing on uniform regions, e.g. empty or still ones, consult it to skip
+whole blocks instead of scanning them cell by cell.
+Blocks are updated one by one, so that the caller can split them among
+threads.
+*/
+class BlockSummary {
+public:
+    static constexpr std::size_t block_size = 8;
+
+private:
+    std::array<std::size_t, 3> _shape{}, _nblocks{};
+    std::vector<double> _min_fraction, _max_fraction, _max_speed;
+
+public:
+    BlockSummary() = default;
+    explicit BlockSummary(const std::array<std::size_t, 3>& shape) {
+        resize(shape);
+    }
+
+    // Cover a grid of the given shape; the blocks must then be updated
+    void resize(const std::array<std::size_t, 3>& shape) {
+        _shape = shape;
+        for(int dim = 0; dim < 3; dim++)
+            _nblocks[dim] = (shape[dim] + block_size - 1) / block_size;
+        _min_fraction.resize(nb_blocks());
+        _max_fraction.resize(nb_blocks());
+        _max_speed.resize(nb_blocks());
+    }
+
+    const std::array<std::size_t, 3>& shape() const {
+        return _shape;
+    }
+    const std::array<std::size_t, 3>& nblocks() const {
+        return _nblocks;
+    }
+    std::size_t nb_blocks() const {
+        return _nblocks[0] * _nblocks[1] * _nblocks[2];
+    }
+    std::size_t index(const std::array<std::size_t, 3>& block) const {
+        return (block[0] * _nblocks[1] + block[1]) * _nblocks[2] + block[2];
+    }
+    std::array<std::size_t, 3> block(std::size_t index) const {
+        return {index / (_nblocks[1] * _nblocks[2]),
+                index / _nblocks[2] % _nblocks[1], index % _nblocks[2]};
+    }
+    // Index of the block of a cell
+    std::size_t block_of(const std::array<std::size_t, 3>& idxs) const {
+        return index({idxs[0] / block_size, idxs[1] / block_size,
+                      idxs[2] / block_size});
+    }
+    // Cells of block index, in [begin, end) along each axis
+    std::array<std::size_t, 3> begin(std::size_t index) const {
+        const auto b = block(index);
+        return {b[0] * block_size, b[1] * block_size, b[2] * block_size};
+    }
+    std::array<std::size_t, 3> end(std::size_t index) const {
+        auto result = begin(index);
+        for(int dim = 0; dim < 3; dim++)
+            result[dim] = std::min(result[dim] + block_size, _shape[dim]);
+        return result;
+    }
+
+    double min_fraction(std::size_t index) const {
+        return _min_fraction[index];
+    }
+    double max_fraction(std::size_t index) const {
+        return _max_fraction[index];
+    }
+    double max_speed(std::size_t index) const {
+        return _max_speed[index];
+    }
+
+    // Range of the volume fraction over the cells of block index
+    template<typename T>
+    void update_fraction(const GridView<T, 3>& volume_fraction,
+                         std::size_t index) {
+        const auto first = begin(index), last = end(index);
+        double low = 1, high = 0;
+        for(std::size_t i = first[0]; i < last[0]; i++) {
+            for(std::size_t j = first[1]; j < last[1]; j++) {
+                const T* row = volume_fraction.data() +
+                               (i * _shape[1] + j) * _shape[2];
+                for(std::size_t k = first[2]; k < last[2]; k++) {
+                    low = std::min<double>(low, row[k]);
+                    high = std::max<double>(high, row[k]);
+                }
+            }
+        }
+        _min_fraction[index] = low;
+        _max_fraction[index] = high;
+    }
+
+    // Largest |u| over the faces of the cells of block index, u[dim] being
+    // staggered along dim
+    template<typename FaceGrid>
+    void update_speed(const FaceGrid (&u)[3], std::size_t index) {
+        const auto first = begin(index), last = end(index);
+        double speed = 0;
+        for(int dim = 0; dim < 3; dim++) {
+            std::array<std::size_t, 3> stop = last, shape = _shape;
+            stop[dim]++;
+            shape[dim]++;
+            for(std::size_t i = first[0]; i < stop[0]; i++) {
+                for(std::size_t j = first[1]; j < stop[1]; j++) {
+                    const auto* row =
+                        u[dim].data() + (i * shape[1] + j) * shape[2];
+                    for(std::size_t k = first[2]; k < stop[2]; k++)
+                        speed = std::max<double>(speed, std::abs(row[k]));
+                }
+            }
+        }
+        _max_speed[index] = speed;
+    }
+};
@@ -1,11 +1,14 @@
 #pragma once
 
 #include "ArrayView.hpp"
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <functional>
 #include <memory>
 #include <numeric>
 #include <ostream>
+#include <type_traits>
 
 template<class dtype, size_t dimension>
 class GridViewIterator;
@@ -203,14 +206,19 @@ class Grid: public GridView<dtype, dimension> {
     Allocator alloc_;
 
 public:
-    Grid(std::array<size_t, dimension> dimensions)
-        : _size(std::move(dimensions)),
+    Grid(std::array<size_t, dimension> dimensions,
+         const Allocator& alloc = Allocator())
+        : _size(std::move(dimensions)), alloc_(alloc),
           GridView<dtype, dimension>(nullptr, this->_size) {
         this->_data = traits::allocate(alloc_, this->size());
+        // CUDAAllocator hands out zeroed memory; make the host path agree
+        if constexpr(std::is_same_v<Allocator, std::allocator<dtype>>) {
+            std::uninitialized_value_construct_n(this->_data, this->size());
+        }
     }
     Grid(const Grid& other) = delete;
     Grid(Grid&& other)
-        : _size(std::move(other._size)),
+        : _size(std::move(other._size)), alloc_(other.alloc_),
           GridView<dtype, dimension>(other._data, this->_size) {
         other._data = nullptr;
     }
@@ -227,6 +235,404 @@ public:
     }
 };
 
+/*
+Linear-offset iteration for stencils on row-major grids of a given shape.
+Neighbours are reached by adding stride(dim) to the offset of a cell, instead
+of recomputing an offset from indices. Cells are split into the interior,
+whose neighbours up to width cells away all exist, and the boundary shell:
+interior loops are plain loops over offsets, without any index bookkeeping or
+bounds test, so that the compiler can vectorize them.
+Both loops take a range of rows along the first dimension, to be split among
+threads (see ThreadPool::parallel_for_chunks).
+*/
+template<size_t dimension>
+class Stencil {
+    static_assert(dimension >= 2);
+    std::array<std::size_t, dimension> _shape;
+    std::array<std::ptrdiff_t, dimension> _stride;
+    std::size_t _width;
+
+    // Range of indices of the interior along dim
+    std::size_t interior_begin(int dim) const {
+        return std::min(_width, _shape[dim]);
+    }
+    std::size_t interior_end(int dim) const {
+        return std::max(interior_begin(dim),
+                        _shape[dim] > _width ? _shape[dim] - _width : 0);
+    }
+
+public:
+    template<typename Dimensions>
+    explicit Stencil(const Dimensions& shape, std::size_t width = 1)
+        : _width(width) {
+        std::copy(shape.begin(), shape.end(), _shape.begin());
+        std::ptrdiff_t stride = 1;
+        for(std::size_t dim = dimension; dim-- > 0;) {
+            _stride[dim] = stride;
+            stride *= _shape[dim];
+        }
+    }
+
+    const std::array<std::size_t, dimension>& shape() const {
+        return _shape;
+    }
+    // Offset from a cell to its neighbour at +1 along dim
+    std::ptrdiff_t stride(int dim) const {
+        return _stride[dim];
+    }
+    std::size_t offset(const std::array<std::size_t, dimension>& idxs) const {
+        std::size_t result = 0;
+        for(std::size_t dim = 0; dim < dimension; dim++)
+            result += idxs[dim] * _stride[dim];
+        return result;
+    }
+
+    bool is_interior(const std::array<std::size_t, dimension>& idxs) const {
+        for(std::size_t dim = 0; dim < dimension; dim++) {
+            if(idxs[dim] < interior_begin(dim) or
+               idxs[dim] >= interior_end(dim))
+                return false;
+        }
+        return true;
+    }
+
+    // Call f(offset) for every interior cell of the rows [row_begin, row_end)
+    template<typename F>
+    void for_each_interior(std::size_t row_begin, std::size_t row_end,
+                           F&& f) const {
+        for_each_interior_row(
+            row_begin, row_end,
+            [&](const auto&, std::size_t first, std::size_t count) {
+                for(std::size_t c = first; c < first + count; c++) f(c);
+            });
+    }
+
+    // Call f(idxs, offset, count) for every contiguous run of interior
+    // cells along the last dimension, idxs and offset being its first cell.
+    // Kernels that also access grids of other shapes (e.g. staggered) map
+    // their offsets once per run.
+    template<typename F>
+    void for_each_interior_row(std::size_t row_begin, std::size_t row_end,
+                               F&& f) const {
+        std::array<std::size_t, dimension> begin, end;
+        for(std::size_t dim = 0; dim < dimension; dim++) {
+            begin[dim] = interior_begin(dim);
+            end[dim] = interior_end(dim);
+        }
+        begin[0] = std::max(begin[0], row_begin);
+        end[0] = std::min(end[0], row_end);
+        for(std::size_t dim = 0; dim < dimension - 1; dim++) {
+            if(begin[dim] >= end[dim])
+                return;
+        }
+        constexpr int last = dimension - 1;
+        std::array<std::size_t, dimension> idxs = begin;
+        while(true) {
+            // idxs[last] stays at begin[last]
+            if(begin[last] < end[last]) {
+                f(static_cast<const std::array<std::size_t, dimension>&>(idxs),
+                  offset(idxs), end[last] - begin[last]);
+            }
+            // Next row: carry over the outer dimensions
+            int dim = last - 1;
+            for(; dim >= 0; dim--) {
+                if(++idxs[dim] != end[dim])
+                    break;
+                idxs[dim] = begin[dim];
+            }
+            if(dim < 0)
+                return;
+        }
+    }
+
+    // Call f(idxs, offset) for every boundary cell of the rows
+    // [row_begin, row_end), in memory order
+    template<typename F>
+    void for_each_boundary(std::size_t row_begin, std::size_t row_end,
+                           F&& f) const {
+        row_end = std::min(row_end, _shape[0]);
+        if(row_begin >= row_end)
+            return;
+        for(std::size_t dim = 1; dim < dimension; dim++) {
+            if(_shape[dim] == 0)
+                return;
+        }
+        constexpr int last = dimension - 1;
+        std::array<std::size_t, dimension> idxs{};
+        idxs[0] = row_begin;
+        while(true) {
+            bool shell_row = false;
+            for(int dim = 0; dim < last; dim++) {
+                shell_row = shell_row or idxs[dim] < interior_begin(dim) or
+                            idxs[dim] >= interior_end(dim);
+            }
+            const std::size_t row = offset(idxs);
+            auto visit = [&](std::size_t k_begin, std::size_t k_end) {
+                for(std::size_t k = k_begin; k < k_end; k++) {
+                    idxs[last] = k;
+                    f(static_cast<const std::array<std::size_t, dimension>&>(
+                          idxs),
+                      row + k);
+                }
+            };
+            if(shell_row) {
+                visit(0, _shape[last]);
+            } else {
+                visit(0, interior_begin(last));
+                visit(interior_end(last), _shape[last]);
+            }
+            idxs[last] = 0;
+            int dim = last - 1;
+            for(; dim >= 0; dim--) {
+                if(++idxs[dim] != (dim == 0 ? row_end : _shape[dim]))
+                    break;
+                idxs[dim] = dim == 0 ? row_begin : 0;
+            }
+            if(dim < 0)
+                return;
+        }
+    }
+};
+
+/*
+Grid of vectors of ncomp components, stored as a structure of arrays: each
+component is a contiguous plane, so that loops over one component use whole
+cache lines and can be vectorized. Cells are still accessed as grid[idxs][c].
+*/
+template<class dtype, size_t ncomp, size_t dimension,
+         typename Allocator = std::allocator<dtype>>
+class VectorGrid {
+    const std::array<size_t, dimension> _size;
+    const ArrayView<size_t, dimension> _size_view;
+    const std::size_t _plane_size;
+    Grid<dtype, dimension + 1, Allocator> _planes;
+
+    static std::array<size_t, dimension + 1>
+    planes_shape(const std::array<size_t, dimension>& dimensions) {
+        std::array<size_t, dimension + 1> result;
+        result[0] = ncomp;
+        std::copy(dimensions.begin(), dimensions.end(), result.begin() + 1);
+        return result;
+    }
+
+public:
+    // The components of one cell, a plane size apart
+    template<class T>
+    class Vector {
+        T* _data;
+        std::size_t _stride;
+
+    public:
+        Vector(T* data, std::size_t stride): _data(data), _stride(stride) {
+        }
+        T& operator[](std::size_t c) const {
+            assert(c < ncomp);
+            return _data[c * _stride];
+        }
+        operator std::array<std::remove_const_t<T>, ncomp>() const {
+            std::array<std::remove_const_t<T>, ncomp> result;
+            for(std::size_t c = 0; c < ncomp; c++) result[c] = (*this)[c];
+            return result;
+        }
+        // Assignments write the components, not the reference
+        const Vector&
+        operator=(const std::array<std::remove_const_t<T>, ncomp>& v) const {
+            for(std::size_t c = 0; c < ncomp; c++) (*this)[c] = v[c];
+            return *this;
+        }
+        const Vector& operator=(const Vector& other) const {
+            for(std::size_t c = 0; c < ncomp; c++) (*this)[c] = other[c];
+            return *this;
+        }
+    };
+
+    VectorGrid(std::array<size_t, dimension> dimensions,
+               const Allocator& alloc = Allocator())
+        : _size(std::move(dimensions)),
+          _size_view(const_cast<size_t*>(_size.data())),
+          _plane_size(std::reduce(_size.begin(), _size.end(), std::size_t{1},
+                                  std::multiplies<std::size_t>{})),
+          _planes(planes_shape(_size), alloc) {
+    }
+    VectorGrid(const VectorGrid& other) = delete;
+    VectorGrid(VectorGrid&& other)
+        : _size(other._size), _size_view(const_cast<size_t*>(_size.data())),
+          _plane_size(other._plane_size), _planes(std::move(other._planes)) {
+    }
+
+    const std::array<size_t, dimension>& shape() const {
+        return _size;
+    }
+    Shape<dimension> indices() const {
+        return Shape(_size_view);
+    }
+    // Number of cells
+    std::size_t size() const {
+        return _plane_size;
+    }
+    std::size_t idx_to_offset(std::array<std::size_t, dimension> idxs) const {
+        std::size_t offset = 0;
+        for(std::size_t dim = 0; dim < dimension; dim++) {
+            offset *= _size[dim];
+            assert(idxs[dim] < _size[dim]);
+            offset += idxs[dim];
+        }
+        return offset;
+    }
+
+    // Return a copy, because this is a View anyway (no data gets copied)
+    GridView<dtype, dimension> component(std::size_t c) const {
+        assert(c < ncomp);
+        return _planes[c];
+    }
+
+    Vector<dtype> operator[](std::array<std::size_t, dimension> idxs) {
+        return {_planes.data() + idx_to_offset(idxs), _plane_size};
+    }
+    Vector<const dtype>
+    operator[](std::array<std::size_t, dimension> idxs) const {
+        return {_planes.data() + idx_to_offset(idxs), _plane_size};
+    }
+};
+
+/*
+Grid stored as bricks of brick cells along every dimension, each brick being
+contiguous: the neighbours of a cell along any dimension are then usually a
+few cache lines away, instead of a whole row or plane for the outer
+dimensions of a row-major grid. The bricks themselves are in row-major order,
+and the shape is padded to whole bricks.
+Cells are accessed as grid[idxs], like a GridView. assign() and copy_to()
+convert from and to the row-major layout, e.g. for I/O.
+*/
+template<class dtype, size_t dimension, size_t brick = 8,
+         typename Allocator = std::allocator<dtype>>
+class BrickGrid {
+    static_assert(brick > 0 and (brick & (brick - 1)) == 0,
+                  "Bricks must be a power of two wide");
+    static constexpr std::size_t brick_size = [] {
+        std::size_t result = 1;
+        for(std::size_t dim = 0; dim < dimension; dim++) result *= brick;
+        return result;
+    }();
+    const std::array<size_t, dimension> _size;
+    const ArrayView<size_t, dimension> _size_view;
+    // Number of bricks along each dimension
+    std::array<size_t, dimension> _nbricks;
+    Grid<dtype, 2, Allocator> _bricks;
+
+    static std::array<size_t, dimension>
+    bricks_shape(const std::array<size_t, dimension>& dimensions) {
+        std::array<size_t, dimension> result;
+        for(std::size_t dim = 0; dim < dimension; dim++)
+            result[dim] = (dimensions[dim] + brick - 1) / brick;
+        return result;
+    }
+
+    // Call f(row_major_offset, offset, count) for every run of count cells
+    // that is contiguous in both layouts, i.e. part of a row in one brick
+    template<typename F>
+    void for_each_run(F&& f) const {
+        constexpr int last = dimension - 1;
+        for(std::size_t dim = 0; dim < dimension; dim++) {
+            if(_size[dim] == 0)
+                return;
+        }
+        std::array<std::size_t, dimension> idxs{};
+        std::size_t row = 0;
+        while(true) {
+            for(idxs[last] = 0; idxs[last] < _size[last];
+                idxs[last] += brick) {
+                f(row + idxs[last], idx_to_offset(idxs),
+                  std::min(brick, _size[last] - idxs[last]));
+            }
+            idxs[last] = 0;
+            row += _size[last];
+            int dim = last - 1;
+            for(; dim >= 0; dim--) {
+                if(++idxs[dim] != _size[dim])
+                    break;
+                idxs[dim] = 0;
+            }
+            if(dim < 0)
+                return;
+        }
+    }
+
+public:
+    BrickGrid(std::array<size_t, dimension> dimensions,
+              const Allocator& alloc = Allocator())
+        : _size(std::move(dimensions)),
+          _size_view(const_cast<size_t*>(_size.data())),
+          _nbricks(bricks_shape(_size)),
+          _bricks({std::reduce(_nbricks.begin(), _nbricks.end(),
+                               std::size_t{1},
+                               std::multiplies<std::size_t>{}),
+                   brick_size},
+                  alloc) {
+    }
+    BrickGrid(const BrickGrid& other) = delete;
+    BrickGrid(BrickGrid&& other)
+        : _size(other._size), _size_view(const_cast<size_t*>(_size.data())),
+          _nbricks(other._nbricks), _bricks(std::move(other._bricks)) {
+    }
+
+    const std::array<size_t, dimension>& shape() const {
+        return _size;
+    }
+    Shape<dimension> indices() const {
+        return Shape(_size_view);
+    }
+    // Number of cells, without the padding
+    std::size_t size() const {
+        return std::reduce(_size.begin(), _size.end(), std::size_t{1},
+                           std::multiplies<std::size_t>{});
+    }
+    std::size_t idx_to_offset(std::array<std::size_t, dimension> idxs) const {
+        std::size_t brick_offset = 0, cell_offset = 0;
+        for(std::size_t dim = 0; dim < dimension; dim++) {
+            assert(idxs[dim] < _size[dim]);
+            brick_offset = brick_offset * _nbricks[dim] + idxs[dim] / brick;
+            cell_offset = cell_offset * brick + idxs[dim] % brick;
+        }
+        return brick_offset * brick_size + cell_offset;
+    }
+
+    dtype* data() {
+        return _bricks.data();
+    }
+    const dtype* data() const {
+        return _bricks.data();
+    }
+
+    dtype& operator[](std::array<std::size_t, dimension> idxs) {
+        return _bricks.data()[idx_to_offset(idxs)];
+    }
+    const dtype& operator[](std::array<std::size_t, dimension> idxs) const {
+        return _bricks.data()[idx_to_offset(idxs)];
+    }
+
+    // Copy a row-major grid of the same shape
+    void assign(const GridView<dtype, dimension>& row_major) {
+        assert(std::equal(_size.begin(), _size.end(),
+                          row_major.shape().begin()));
+        const dtype* source = row_major.data();
+        dtype* destination = data();
+        for_each_run([&](std::size_t from, std::size_t to, std::size_t count) {
+            std::copy(source + from, source + from + count, destination + to);
+        });
+    }
+    // Copy to a row-major grid of the same shape
+    void copy_to(GridView<dtype, dimension>& row_major) const {
+        assert(std::equal(_size.begin(), _size.end(),
+                          row_major.shape().begin()));
+        const dtype* source = data();
+        dtype* destination = row_major.data();
+        for_each_run([&](std::size_t to, std::size_t from, std::size_t count) {
+            std::copy(source + from, source + from + count, destination + to);
+        });
+    }
+};
+
 struct CUDAMalloc {
     static void* calloc(std::size_t size, std::size_t num);
     static void free(void* mem);
@@ -236,6 +642,11 @@ template<typename T>
 struct CUDAAllocator {
     using value_type = T;
 
+    CUDAAllocator() = default;
+    template<typename U>
+    CUDAAllocator(const CUDAAllocator<U>&) {
+    }
+
     T* allocate(std::size_t n) {
         return static_cast<T*>(CUDAMalloc::calloc(n, sizeof(T)));
     }
@@ -2,16 +2,19 @@
 #include "scheme.hpp"
 #include "viewer.hpp"
 #include "marching_cubes/renderer.hpp"
+#include "vof/ensemble.hpp"
 #include "vof/vof.hpp"
 #include <boost/program_options.hpp>
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <stdexcept>
 #include <variant>
 
 #ifdef NUMPY_LOAD
 #include "npz_loader.hpp"
-#include <fstream>
-#include <stdexcept>
+#include <optional>
 #endif
 
 namespace po = boost::program_options;
@@ -22,10 +25,22 @@ struct PerfRunConfig {
     std::vector<unsigned int> niters;
 };
 
+// Runs the cases of the file concurrently, see read_ensemble_cases
+struct EnsembleRunConfig {
+    std::string cases_file;
+};
+
 struct RunConfig {
     std::size_t grid_size = 100;
     double time_step = 0.01;
-    std::variant<UIRunConfig, PerfRunConfig> specific_config;
+    // time_step is then the largest step
+    bool adaptive_time_step = false;
+    // In perf mode, every thread count is timed; the UI uses the first one,
+    // and the ensemble runs that many cases at once
+    std::vector<unsigned int> nthreads = {1};
+    PressureSolverOptions pressure_solver;
+    std::variant<UIRunConfig, PerfRunConfig, EnsembleRunConfig>
+        specific_config;
 #ifdef NUMPY_LOAD
     std::optional<std::string> input_file;
 #endif
@@ -38,8 +53,16 @@ RunConfig parse_options(int argc, char* argv[]) {
     regular_options.add_options()
         ("help,h", "Show help")
         ("perf,p", "Run without GUI for [N] iterations to test performance")
+        ("ensemble", po::value<std::string>(), "Run without GUI the cases of the file, one per line: name size steps timestep [input|- [density_ratio]]")
         ("size,s", po::value<unsigned int>(), "Set grid size to s")
-        ("timestep,t", po::value<double>())
+        ("timestep,t", po::value<double>(), "Time step (the largest one with --adaptive-timestep)")
+        ("adaptive-timestep", "Take the largest time step the scheme reports as stable, up to --timestep")
+        ("threads,j", po::value<std::vector<unsigned int>>()->multitoken(),
+            "Number of CPU threads (several values in perf mode give a scaling table; cases run at once in ensemble mode)")
+        ("pressure-solver", po::value<std::string>(), "Pressure solver: eigen, eigen-ic, matrix-free, multigrid or multigrid-cg")
+        ("pressure-tolerance", po::value<double>(), "Relative residual at which the pressure solver stops")
+        ("preconditioner-reuse", po::value<unsigned int>(), "Number of steps the pressure preconditioner is kept before being rebuilt")
+        ("pressure-stats", "Print the iterations and residual of every pressure solve to stderr")
 #ifdef NUMPY_LOAD
         ("input,i", po::value<std::string>(), "Load initial conditions from input file")
 #endif
@@ -74,6 +97,9 @@ RunConfig parse_options(int argc, char* argv[]) {
         PerfRunConfig config_;
         config_.niters = vm["niters"].as<std::vector<unsigned int>>();
         config.specific_config = config_;
+    } else if(vm.count("ensemble")) {
+        config.specific_config =
+            EnsembleRunConfig{vm["ensemble"].as<std::string>()};
     } else {
         config.specific_config = UIRunConfig();
     }
@@ -83,6 +109,40 @@ RunConfig parse_options(int argc, char* argv[]) {
     if(vm.count("timestep")) {
         config.time_step = vm["timestep"].as<double>();
     }
+    if(vm.count("adaptive-timestep")) {
+        config.adaptive_time_step = true;
+    }
+    if(vm.count("threads")) {
+        config.nthreads = vm["threads"].as<std::vector<unsigned int>>();
+    }
+    if(vm.count("pressure-solver")) {
+        const auto& solver = vm["pressure-solver"].as<std::string>();
+        if(solver == "eigen") {
+            config.pressure_solver.kind = PressureSolverKind::EigenCG;
+        } else if(solver == "eigen-ic") {
+            config.pressure_solver.kind =
+                PressureSolverKind::EigenIncompleteCholeskyCG;
+        } else if(solver == "matrix-free") {
+            config.pressure_solver.kind = PressureSolverKind::MatrixFreeCG;
+        } else if(solver == "multigrid") {
+            config.pressure_solver.kind = PressureSolverKind::Multigrid;
+        } else if(solver == "multigrid-cg") {
+            config.pressure_solver.kind = PressureSolverKind::MultigridCG;
+        } else {
+            throw po::invalid_option_value(solver);
+        }
+    }
+    if(vm.count("pressure-tolerance")) {
+        config.pressure_solver.tolerance =
+            vm["pressure-tolerance"].as<double>();
+    }
+    if(vm.count("preconditioner-reuse")) {
+        config.pressure_solver.preconditioner_reuse =
+            vm["preconditioner-reuse"].as<unsigned int>();
+    }
+    if(vm.count("pressure-stats")) {
+        config.pressure_solver.log = &std::cerr;
+    }
 #ifdef NUMPY_LOAD
     if(vm.count("input")) {
         config.input_file = vm["input"].as<std::string>();
@@ -91,6 +151,23 @@ RunConfig parse_options(int argc, char* argv[]) {
     return config;
 }
 
+#ifdef NUMPY_LOAD
+// Set the volume fraction of grid from an .npy file of its shape
+template<typename StaggeredGrid>
+void load_volume_fraction(const std::string& filename, StaggeredGrid& grid) {
+    std::ifstream file(filename.c_str(), std::ios::binary | std::ios::in);
+    if(!file.is_open()) {
+        throw std::runtime_error("Couldn't open file!");
+    }
+    Grid<double, 3> init = load<double, 3>(file);
+    if(init.shape() != grid.volume_fraction.shape()) {
+        throw std::runtime_error(filename + " does not have the grid size");
+    }
+    std::copy(init.data(), init.data() + init.size(),
+              grid.volume_fraction.data());
+}
+#endif
+
 int main(int argc, char* argv[]) {
     auto options = parse_options(argc, argv);
 
@@ -100,47 +177,108 @@ int main(int argc, char* argv[]) {
     for(int i = 0; i < 3; i++) {
         dims[i] = options.grid_size;
     }
+#ifdef SINGLE_PRECISION
+    using scalar = float;
+#else
+    using scalar = double;
+#endif
+#ifdef QUANTIZED_VOLUME_FRACTION
+    using fraction = UNorm16;
+#else
+    using fraction = scalar;
+#endif
 #ifdef NO_CUDA
-    using VOF = VOF<std::allocator>;
+    using VOF = VOF<std::allocator, WallBoundary, scalar, fraction>;
 #else
-    using VOF = VOF<>;
+    using VOF = VOF<CUDAAllocator, WallBoundary, scalar, fraction>;
 #endif
 
-    World<VOF::Grid, 3> world(dims, options.time_step);
-    const VOF scheme;
+    auto ensemble = std::get_if<EnsembleRunConfig>(&options.specific_config);
+    if(ensemble) {
+        std::ifstream cases_file(ensemble->cases_file);
+        if(!cases_file.is_open()) {
+            throw std::runtime_error("Couldn't open file!");
+        }
+        const auto cases = read_ensemble_cases(cases_file);
+        // Cases with the same input and size share their initial grid, which
+        // is loaded once
+        std::map<std::pair<std::string, std::size_t>, VOF::Grid> initial_grids;
+        std::vector<const VOF::Grid*> case_grids;
+        for(const auto& ensemble_case: cases) {
+            const std::size_t size = ensemble_case.grid_size;
+            const auto [it, inserted] = initial_grids.try_emplace(
+                {ensemble_case.input, size},
+                std::array<std::size_t, 3>{size, size, size});
+            if(inserted and not ensemble_case.input.empty()) {
+#ifdef NUMPY_LOAD
+                load_volume_fraction(ensemble_case.input, it->second);
+#else
+                throw std::runtime_error("Input files need NUMPY_LOAD");
+#endif
+            }
+            case_grids.push_back(&it->second);
+        }
+
+        std::cout << "#case,size,density_ratio,steps,t,time[ms],mass"
+                  << std::endl;
+        auto t1 = high_resolution_clock::now();
+        const auto results = run_ensemble<VOF>(
+            cases,
+            [&](std::size_t n) -> const VOF::Grid& { return *case_grids[n]; },
+            options.nthreads.front(), options.adaptive_time_step,
+            options.pressure_solver);
+        auto t2 = high_resolution_clock::now();
+        for(std::size_t n = 0; n < cases.size(); n++) {
+            std::cout << cases[n].name << "," << cases[n].grid_size << ","
+                      << cases[n].density_ratio << "," << results[n].steps
+                      << "," << results[n].t << "," << results[n].time_ms
+                      << "," << results[n].mass << std::endl;
+        }
+        duration<double, std::milli> runtime = t2 - t1;
+        std::cout << "# " << cases.size() << " cases in " << runtime.count()
+                  << " ms" << std::endl;
+        return 0;
+    }
+
+    World<VOF::Grid, 3> world(dims, options.time_step,
+                              options.adaptive_time_step);
     VOF::Grid initialGrid(dims);
 #ifdef NUMPY_LOAD
     if(options.input_file) {
-        std::ifstream file(options.input_file->c_str(),
-                           std::ios::binary | std::ios::in);
-        if(!file.is_open()) {
-            throw std::runtime_error("Couldn't open file!");
-        }
-        Grid<double, 3> init = load<double, 3>(file);
-        initialGrid.volume_fraction = init;
+        load_volume_fraction(*options.input_file, initialGrid);
     }
 #endif
     world.reset(initialGrid);
 
     auto config = std::get_if<PerfRunConfig>(&options.specific_config);
     if(config) {
-        std::cout << "#N,time[ms]" << std::endl;
-        for(const unsigned int niters: config->niters) {
-            std::cout << niters << ",";
-            world.reset(initialGrid);
-            auto t1 = high_resolution_clock::now();
-            world.multi_step(niters, scheme);
-            synchronize();
-            auto t2 = high_resolution_clock::now();
-            duration<double, std::milli> runtime = t2 - t1;
-            std::cout << runtime.count() << std::endl;
+        std::cout << "#threads,N,time[ms],speedup" << std::endl;
+        std::vector<double> reference_runtimes;
+        for(const unsigned int nthreads: options.nthreads) {
+            const VOF scheme(nthreads, options.pressure_solver);
+            for(std::size_t i = 0; i < config->niters.size(); i++) {
+                const unsigned int niters = config->niters[i];
+                std::cout << nthreads << "," << niters << ",";
+                world.reset(initialGrid);
+                auto t1 = high_resolution_clock::now();
+                world.multi_step(niters, scheme);
+                synchronize();
+                auto t2 = high_resolution_clock::now();
+                duration<double, std::milli> runtime = t2 - t1;
+                // Speedup relative to the first thread count
+                if(reference_runtimes.size() <= i)
+                    reference_runtimes.push_back(runtime.count());
+                std::cout << runtime.count() << ","
+                          << reference_runtimes[i] / runtime.count()
+                          << std::endl;
+            }
         }
     } else {
-        Viewer<GridView<double, 3>, Renderer3D> myGlfw;
+        const VOF scheme(options.nthreads.front(), options.pressure_solver);
+
+        // Meshes snapshots of the volume fraction, converted to double
+        Viewer<Grid<double, 3>, Renderer3D> myGlfw(dims);
 
-        const steady_clock::duration dt_as_duration =
-            duration_cast<steady_clock::duration>(
-                duration<float, std::milli>(1000 * options.time_step));
         auto tick_time = steady_clock::now();
 
         try {
@@ -148,7 +286,8 @@ int main(int argc, char* argv[]) {
                 world.step(scheme);
                 synchronize();
                 myGlfw.render(world.grid().volume_fraction);
-                tick_time += dt_as_duration;
+                tick_time += duration_cast<steady_clock::duration>(
+                    duration<float, std::milli>(1000 * world.last_dt));
                 std::this_thread::sleep_until(tick_time);
             }
         } catch(const Viewer<Grid<double, 3>, Renderer3D>::WindowClosed&) {
@@ -2,15 +2,22 @@
 #include "grid.hpp"
 #include "cube_utils/permute.hpp"
 #include "generated/marching_cubes_cache.hpp"
+#include "thread_pool.hpp"
 #ifdef TIMING
 #include "timing.hpp"
 #endif
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <numeric>
 #include <span>
 
 using std::size_t;
 
 namespace waves_on_cuda::marching_cubes {
 
+using geometry::IndexedMesh;
 using geometry::Point3D;
 using geometry::Triangle;
 
@@ -33,33 +40,18 @@ bool interior_test(const std::array<float, NB_VERTICES>& v) {
     return false;
 }
 
-void marching_cube(int x, int y, int z, double isoLevel,
-                   const GridView<double, 3>& grid,
-                   std::vector<Triangle<float>>& out) {
+// Triangles of cube (x, y, z), in the order of the lookup table, with their
+// corners numbered like the edges of the cube, or NB_EDGES for its center.
+// Fills v with the values at the vertices of the cube and returns the number
+// of triangles. Works on any grid indexed as grid[idxs] (GridView or
+// BrickGrid).
+template<typename GridType>
+int cube_triangles(size_t x, size_t y, size_t z, double isoLevel,
+                   const GridType& grid, std::array<float, NB_VERTICES>& v,
+                   std::array<std::array<unsigned char, 3>, 12>& triangles) {
     // Fetch 8 corner values
-    std::array<float, NB_VERTICES> v;
     for(int i = 0; i < NB_VERTICES; i++) {
-        v[i] = grid[z + ((i >> 2) & 1)][y + ((i >> 1) & 1)][x + (i & 1)];
-    }
-
-    std::array<Point3D<float>, NB_EDGES + 1> intersect_and_center;
-    std::span<Point3D<float>, NB_EDGES> intersect =
-        std::span(intersect_and_center).first<NB_EDGES>();
-    std::array<float, 3> base = {static_cast<float>(z), static_cast<float>(y),
-                                 static_cast<float>(x)};
-    intersect_and_center[NB_EDGES] =
-        Point3D<float>({base[0] + 0.5f, base[1] + 0.5f, base[2] + 0.5f});
-    for(int i = 0; i < NB_EDGES; i++) {
-        auto edge = cube_geometry.edge_definition[i];
-        double a = v[edge.a], b = v[edge.b];
-        std::array<float, 3> midpoint = {static_cast<float>(edge.x),
-                                         static_cast<float>(edge.y),
-                                         static_cast<float>(edge.z)};
-        midpoint[edge.changing_dim] = (a - isoLevel) / (a - b);
-        std::array<float, 3> midpoint_scale;
-        for(int j = 0; j < 3; j++)
-            midpoint_scale[j] = (base[j] + midpoint[j]) / (grid.shape()[j] - 1);
-        intersect[i] = Point3D(midpoint_scale);
+        v[i] = grid[{z + ((i >> 2) & 1), y + ((i >> 1) & 1), x + (i & 1)}];
     }
 
     unsigned char index_ = 0;
@@ -67,11 +59,18 @@ void marching_cube(int x, int y, int z, double isoLevel,
         if(v[i] > isoLevel)
             index_ += (1 << i);
     }
+    // Most cubes are on one side of the surface
+    if(index_ == 0 or index_ == 255)
+        return 0;
     const auto& case_ptr = lookup_table.case_table[index_];
-    permute(intersect,
+    // The tables refer to the edges and vertices of a rotated cube
+    std::array<unsigned char, NB_EDGES> edges;
+    std::iota(edges.begin(), edges.end(), 0);
+    std::array<float, NB_VERTICES> rotated = v;
+    permute(std::span(edges),
             std::span(cube_geometry.all_permutations[case_ptr.permutation]
                           .edge_permutation));
-    permute(std::span(v),
+    permute(std::span(rotated),
             std::span(cube_geometry.all_permutations[case_ptr.permutation]
                           .vertex_permutation));
     bool sign_flip = case_ptr.sign_flip;
@@ -82,38 +81,127 @@ void marching_cube(int x, int y, int z, double isoLevel,
     for(int i = 0; i < _case.num_tests; i++) {
         int side = _case.tests[i];
         if(side == 6) {
-            test += (interior_test(v) ? (1 << i) : 0);
+            test += (interior_test(rotated) ? (1 << i) : 0);
         } else {
-            float a = v[cube_geometry.adjacency[side][0]],
-                  b = v[cube_geometry.adjacency[side][1]],
-                  c = v[cube_geometry.adjacency[side][2]],
-                  d = v[cube_geometry.adjacency[side][3]];
+            float a = rotated[cube_geometry.adjacency[side][0]],
+                  b = rotated[cube_geometry.adjacency[side][1]],
+                  c = rotated[cube_geometry.adjacency[side][2]],
+                  d = rotated[cube_geometry.adjacency[side][3]];
             test += ((a * c - b * d) > isoLevel) ? (1 << i) : 0;
         }
     }
     const auto& subcase_ptr = _case.subcases[test];
     sign_flip = sign_flip ^ subcase_ptr.sign_flip;
     const auto& subcase = lookup_table.all_subcases[subcase_ptr.subcase];
-    permute(intersect,
+    permute(std::span(edges),
             std::span(cube_geometry.all_permutations[subcase_ptr.permutation]
                           .edge_permutation));
 
     for(int i = 0; i < subcase.num_triangles; i++) {
+        for(size_t j = 0; j < 3; j++) {
+            const unsigned char corner = subcase.triangles[i][j];
+            triangles[i][sign_flip ? 2 - j : j] =
+                corner == NB_EDGES ? NB_EDGES : edges[corner];
+        }
+    }
+    return subcase.num_triangles;
+}
+
+// Corner of a triangle of cube (x, y, z): the intersection of the surface with
+// edge of the cube, or its center for NB_EDGES. v holds the values at the
+// vertices of the cube.
+template<typename GridType>
+Point3D<float> corner_point(size_t x, size_t y, size_t z, double isoLevel,
+                            const GridType& grid,
+                            const std::array<float, NB_VERTICES>& v,
+                            int edge_index) {
+    std::array<float, 3> base = {static_cast<float>(z), static_cast<float>(y),
+                                 static_cast<float>(x)};
+    if(edge_index == NB_EDGES)
+        return Point3D<float>({base[0] + 0.5f, base[1] + 0.5f, base[2] + 0.5f});
+    auto edge = cube_geometry.edge_definition[edge_index];
+    double a = v[edge.a], b = v[edge.b];
+    std::array<float, 3> midpoint = {static_cast<float>(edge.x),
+                                     static_cast<float>(edge.y),
+                                     static_cast<float>(edge.z)};
+    midpoint[edge.changing_dim] = (a - isoLevel) / (a - b);
+    std::array<float, 3> midpoint_scale;
+    for(int j = 0; j < 3; j++)
+        midpoint_scale[j] = (base[j] + midpoint[j]) / (grid.shape()[j] - 1);
+    return Point3D(midpoint_scale);
+}
+
+// Writes the triangles of cube (x, y, z) to out and returns the iterator past
+// them
+template<typename GridType, typename OutputIt>
+OutputIt marching_cube(size_t x, size_t y, size_t z, double isoLevel,
+                       const GridType& grid, OutputIt out) {
+    std::array<float, NB_VERTICES> v;
+    std::array<std::array<unsigned char, 3>, 12> triangles;
+    const int nb_triangles =
+        cube_triangles(x, y, z, isoLevel, grid, v, triangles);
+    // Corners are shared by the triangles of the cube
+    std::array<Point3D<float>, NB_EDGES + 1> points;
+    unsigned int computed = 0;
+    for(int i = 0; i < nb_triangles; i++) {
         Triangle<float> tri;
         for(size_t j = 0; j < 3; j++) {
-            if(sign_flip) {
-                tri.corners[2 - j] =
-                    intersect_and_center[subcase.triangles[i][j]];
-            } else {
-                tri.corners[j] = intersect_and_center[subcase.triangles[i][j]];
+            const int corner = triangles[i][j];
+            if(not(computed & (1u << corner))) {
+                points[corner] =
+                    corner_point(x, y, z, isoLevel, grid, v, corner);
+                computed |= 1u << corner;
             }
+            tri.corners[j] = points[corner];
         }
-        out.push_back(tri);
+        *out++ = tri;
     }
+    return out;
 }
 
-std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
-                                            double isoLevel) {
+// Number of triangles of a cube from the configuration of its corners alone,
+// or -1 for the ambiguous configurations, where it depends on the tests of
+// cube_triangles
+static const std::array<signed char, 256>& triangle_counts() {
+    static const std::array<signed char, 256> counts = []() {
+        std::array<signed char, 256> result;
+        for(int index = 0; index < 256; index++) {
+            const Case& _case =
+                lookup_table.all_cases[lookup_table.case_table[index]._case];
+            result[index] =
+                _case.num_tests > 0
+                    ? -1
+                    : lookup_table.all_subcases[_case.subcases[0].subcase]
+                          .num_triangles;
+        }
+        return result;
+    }();
+    return counts;
+}
+
+// Number of triangles of cube (x, y, z), the same as cube_triangles, which
+// only runs for the ambiguous configurations
+template<typename GridType>
+int count_cube_triangles(size_t x, size_t y, size_t z, double isoLevel,
+                         const GridType& grid,
+                         const std::array<signed char, 256>& counts) {
+    unsigned char index_ = 0;
+    for(int i = 0; i < NB_VERTICES; i++) {
+        const float v =
+            grid[{z + ((i >> 2) & 1), y + ((i >> 1) & 1), x + (i & 1)}];
+        if(v > isoLevel)
+            index_ += (1 << i);
+    }
+    if(counts[index_] >= 0)
+        return counts[index_];
+    std::array<float, NB_VERTICES> v;
+    std::array<std::array<unsigned char, 3>, 12> triangles;
+    return cube_triangles(x, y, z, isoLevel, grid, v, triangles);
+}
+
+template<typename GridType>
+std::vector<Triangle<float>> all_marching_cubes(const GridType& grid,
+                                                double isoLevel) {
     std::vector<Triangle<float>> out;
     {
 #ifdef TIMING
@@ -121,10 +209,13 @@ std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
         for(int i = 0; i < 1000; i++)
 #endif
         {
-            for(size_t i = 0; i < grid.shape()[0] - 1; i++) {
-                for(size_t j = 0; j < grid.shape()[1] - 1; j++) {
-                    for(size_t k = 0; k < grid.shape()[2] - 1; k++) {
-                        marching_cube(i, j, k, isoLevel, grid, out);
+            // marching_cube(x, y, z) is the cube of the cells [z, z + 1] x
+            // [y, y + 1] x [x, x + 1], visited in the order of the cells
+            for(size_t z = 0; z + 1 < grid.shape()[0]; z++) {
+                for(size_t y = 0; y + 1 < grid.shape()[1]; y++) {
+                    for(size_t x = 0; x + 1 < grid.shape()[2]; x++) {
+                        marching_cube(x, y, z, isoLevel, grid,
+                                      std::back_inserter(out));
                     }
                 }
             }
@@ -133,4 +224,286 @@ std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
     return out;
 }
 
+std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
+                                            double isoLevel) {
+    return all_marching_cubes(grid, isoLevel);
+}
+
+std::vector<Triangle<float>> marching_cubes(const BrickGrid<double, 3>& grid,
+                                            double isoLevel) {
+    return all_marching_cubes(grid, isoLevel);
 }
+
+std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
+                                            double isoLevel, ThreadPool& pool) {
+    // The triangles are not spread evenly along z, so the slabs are thin and
+    // handed out to the threads as they become free
+    constexpr size_t slab_size = 4;
+    const size_t nb_planes = std::max<size_t>(grid.shape()[0], 1) - 1,
+                 nb_slabs = (nb_planes + slab_size - 1) / slab_size;
+    std::vector<std::vector<Triangle<float>>> slabs(nb_slabs);
+    pool.parallel_for_dynamic(0, nb_slabs, [&](size_t slab) {
+        const size_t z_end = std::min(nb_planes, (slab + 1) * slab_size);
+        for(size_t z = slab * slab_size; z < z_end; z++) {
+            for(size_t y = 0; y + 1 < grid.shape()[1]; y++) {
+                for(size_t x = 0; x + 1 < grid.shape()[2]; x++) {
+                    marching_cube(x, y, z, isoLevel, grid,
+                                  std::back_inserter(slabs[slab]));
+                }
+            }
+        }
+    });
+
+    // Concatenate the slabs in order, each at the number of triangles before
+    // it
+    std::vector<size_t> offsets(nb_slabs + 1, 0);
+    for(size_t slab = 0; slab < nb_slabs; slab++)
+        offsets[slab + 1] = offsets[slab] + slabs[slab].size();
+    std::vector<Triangle<float>> out(offsets[nb_slabs]);
+    pool.parallel_for_dynamic(0, nb_slabs, [&](size_t slab) {
+        std::copy(slabs[slab].begin(), slabs[slab].end(),
+                  out.begin() + offsets[slab]);
+    });
+    return out;
+}
+
+std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
+                                            double isoLevel,
+                                            const BlockSummary& blocks,
+                                            std::size_t* skipped) {
+    assert(std::equal(blocks.shape().begin(), blocks.shape().end(),
+                      grid.shape().begin()));
+    // The cubes of a block also reach the first cells of the next blocks.
+    // The corners are compared as floats, and rounding to float keeps the
+    // order, so the range of the rounded values is the rounded range.
+    const auto& nb = blocks.nblocks();
+    std::vector<unsigned char> uniform(blocks.nb_blocks());
+    std::size_t nskipped = 0;
+    for(std::size_t b = 0; b < blocks.nb_blocks(); b++) {
+        const auto block = blocks.block(b);
+        float low = 1, high = 0;
+        for(std::size_t i = block[0]; i <= std::min(block[0] + 1, nb[0] - 1);
+            i++) {
+            for(std::size_t j = block[1];
+                j <= std::min(block[1] + 1, nb[1] - 1); j++) {
+                for(std::size_t k = block[2];
+                    k <= std::min(block[2] + 1, nb[2] - 1); k++) {
+                    const std::size_t n = blocks.index({i, j, k});
+                    low = std::min(low, static_cast<float>(
+                                            blocks.min_fraction(n)));
+                    high = std::max(high, static_cast<float>(
+                                              blocks.max_fraction(n)));
+                }
+            }
+        }
+        uniform[b] = low > isoLevel or high <= isoLevel;
+        nskipped += uniform[b];
+    }
+    if(skipped)
+        *skipped = nskipped;
+
+    // Same order as all_marching_cubes, jumping over the runs of cubes of
+    // the uniform blocks. marching_cube(x, y, z) is the cube of the cells
+    // [z, z + 1] x [y, y + 1] x [x, x + 1].
+    constexpr std::size_t block_size = BlockSummary::block_size;
+    std::vector<Triangle<float>> out;
+    for(size_t z = 0; z + 1 < grid.shape()[0]; z++) {
+        for(size_t y = 0; y + 1 < grid.shape()[1]; y++) {
+            for(size_t x = 0; x + 1 < grid.shape()[2]; x++) {
+                if(uniform[blocks.block_of({z, y, x})]) {
+                    x += block_size - 1 - x % block_size;
+                    continue;
+                }
+                marching_cube(x, y, z, isoLevel, grid,
+                              std::back_inserter(out));
+            }
+        }
+    }
+    return out;
+}
+
+CubeCounts count_triangles(const GridView<double, 3>& grid, double isoLevel) {
+    // Same cubes and order as marching_cubes_indexed
+    const auto& shape = grid.shape();
+    const auto& table = triangle_counts();
+    const size_t nb_rows = (std::max<size_t>(shape[0], 1) - 1) *
+                           (std::max<size_t>(shape[1], 1) - 1),
+                 row_size = std::max<size_t>(shape[2], 1) - 1;
+    CubeCounts counts;
+    counts.triangles.resize(nb_rows * row_size);
+    counts.row_offsets.resize(nb_rows + 1);
+    size_t row = 0, cube = 0, total = 0;
+    for(size_t z = 0; z + 1 < shape[0]; z++) {
+        for(size_t y = 0; y + 1 < shape[1]; y++) {
+            counts.row_offsets[row++] = total;
+            for(size_t x = 0; x + 1 < shape[2]; x++) {
+                counts.triangles[cube] =
+                    count_cube_triangles(x, y, z, isoLevel, grid, table);
+                total += counts.triangles[cube++];
+            }
+        }
+    }
+    counts.row_offsets[nb_rows] = total;
+    return counts;
+}
+
+void fill_triangles(const GridView<double, 3>& grid, double isoLevel,
+                    const CubeCounts& counts, std::span<Triangle<float>> out) {
+    assert(out.size() == counts.total());
+    const auto& shape = grid.shape();
+    const size_t row_size = std::max<size_t>(shape[2], 1) - 1;
+    // Every row starts at its own offset, so that the rows could as well be
+    // filled in any order
+    size_t row = 0;
+    for(size_t z = 0; z + 1 < shape[0]; z++) {
+        for(size_t y = 0; y + 1 < shape[1]; y++, row++) {
+            Triangle<float>* next = out.data() + counts.row_offsets[row];
+            const unsigned char* cubes = &counts.triangles[row * row_size];
+            for(size_t x = 0; x < row_size; x++) {
+                if(cubes[x] != 0)
+                    next = marching_cube(x, y, z, isoLevel, grid, next);
+            }
+            assert(next == out.data() + counts.row_offsets[row + 1]);
+        }
+    }
+}
+
+std::vector<size_t> IncrementalMesher::update(const GridView<double, 3>& grid) {
+    const auto& shape = grid.shape();
+    const bool same_shape =
+        not previous.empty() and
+        std::equal(shape.begin(), shape.end(), _shape.begin());
+    if(not same_shape) {
+        std::copy(shape.begin(), shape.end(), _shape.begin());
+        for(int dim = 0; dim < 3; dim++)
+            _nblocks[dim] = (std::max<size_t>(shape[dim], 1) - 1 +
+                             block_size - 1) / block_size;
+        blocks.assign(_nblocks[0] * _nblocks[1] * _nblocks[2], {});
+        previous.resize(grid.size());
+    }
+
+    // marching_cube(x, y, z) is the cube of the cells [z, z + 1] x [y, y + 1]
+    // x [x, x + 1], so the cubes of a block, in [begin, end) along each axis,
+    // read the cells in [begin, end], up to the first ones of the next blocks
+    auto cubes = [&](size_t b, std::array<size_t, 3>& begin,
+                     std::array<size_t, 3>& end) {
+        begin = {b / (_nblocks[1] * _nblocks[2]) * block_size,
+                 b / _nblocks[2] % _nblocks[1] * block_size,
+                 b % _nblocks[2] * block_size};
+        for(int dim = 0; dim < 3; dim++)
+            end[dim] = std::min(begin[dim] + block_size, shape[dim] - 1);
+    };
+    std::vector<size_t> changed;
+    const double* values = grid.data();
+    const auto& table = triangle_counts();
+    std::array<size_t, 3> begin, end;
+    for(size_t b = 0; b < blocks.size(); b++) {
+        cubes(b, begin, end);
+        bool dirty = not same_shape;
+        for(size_t z = begin[0]; not dirty and z <= end[0]; z++) {
+            for(size_t y = begin[1]; not dirty and y <= end[1]; y++) {
+                const size_t row = (z * shape[1] + y) * shape[2];
+                for(size_t x = begin[2]; not dirty and x <= end[2]; x++)
+                    dirty = previous[row + x] != static_cast<float>(
+                                                     values[row + x]);
+            }
+        }
+        if(not dirty)
+            continue;
+        changed.push_back(b);
+        // Count the triangles, then fill the block at its exact size
+        block_cubes.clear();
+        size_t total = 0;
+        for(size_t z = begin[0]; z < end[0]; z++) {
+            for(size_t y = begin[1]; y < end[1]; y++) {
+                for(size_t x = begin[2]; x < end[2]; x++) {
+                    block_cubes.push_back(
+                        count_cube_triangles(x, y, z, isoLevel, grid, table));
+                    total += block_cubes.back();
+                }
+            }
+        }
+        blocks[b].resize(total);
+        Triangle<float>* out = blocks[b].data();
+        const unsigned char* cube = block_cubes.data();
+        for(size_t z = begin[0]; z < end[0]; z++) {
+            for(size_t y = begin[1]; y < end[1]; y++) {
+                for(size_t x = begin[2]; x < end[2]; x++, cube++) {
+                    if(*cube != 0)
+                        out = marching_cube(x, y, z, isoLevel, grid, out);
+                }
+            }
+        }
+        assert(out == blocks[b].data() + total);
+    }
+    // Only the cells of the blocks that changed differ from the copy. They
+    // are copied once all the blocks are compared, as neighbouring blocks
+    // share cells.
+    for(const size_t b: changed) {
+        cubes(b, begin, end);
+        for(size_t z = begin[0]; z <= end[0]; z++) {
+            for(size_t y = begin[1]; y <= end[1]; y++) {
+                const size_t row = (z * shape[1] + y) * shape[2];
+                std::copy(values + row + begin[2], values + row + end[2] + 1,
+                          previous.begin() + row + begin[2]);
+            }
+        }
+    }
+    return changed;
+}
+
+IndexedMesh<float> marching_cubes_indexed(const GridView<double, 3>& grid,
+                                          double isoLevel) {
+    // marching_cube(x, y, z) is the cube of the cells [z, z + 1] x [y, y + 1]
+    // x [x, x + 1], visited in the order of the cells like all_marching_cubes
+    const auto& shape = grid.shape();
+    IndexedMesh<float> mesh;
+    // Vertex of every edge from a point of two planes of constant z, along
+    // each axis. The cubes of one z span both, and the next z reuses the
+    // second plane and overwrites the first one.
+    constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+    const std::size_t plane_size = 3 * shape[1] * shape[2];
+    std::vector<std::uint32_t> planes[2] = {
+        std::vector<std::uint32_t>(plane_size, none),
+        std::vector<std::uint32_t>(plane_size, none)};
+
+    std::array<float, NB_VERTICES> v;
+    std::array<std::array<unsigned char, 3>, 12> triangles;
+    for(size_t z = 0; z + 1 < shape[0]; z++) {
+        if(z > 0)
+            std::fill(planes[(z + 1) % 2].begin(), planes[(z + 1) % 2].end(),
+                      none);
+        for(size_t y = 0; y + 1 < shape[1]; y++) {
+            for(size_t x = 0; x + 1 < shape[2]; x++) {
+                const int nb_triangles =
+                    cube_triangles(x, y, z, isoLevel, grid, v, triangles);
+                std::uint32_t center = none;
+                for(int t = 0; t < nb_triangles; t++) {
+                    for(int c = 0; c < 3; c++) {
+                        const int corner = triangles[t][c];
+                        // edge.x, .y and .z offset the first point of the
+                        // edge along the axes of the grid, z, y and x here
+                        std::uint32_t* id = &center;
+                        if(corner != NB_EDGES) {
+                            const auto edge =
+                                cube_geometry.edge_definition[corner];
+                            id = &planes[(z + edge.x) % 2]
+                                        [(edge.changing_dim * shape[1] + y +
+                                          edge.y) * shape[2] + x + edge.z];
+                        }
+                        if(*id == none) {
+                            assert(mesh.vertices.size() < none);
+                            *id = mesh.vertices.size();
+                            mesh.vertices.push_back(corner_point(
+                                x, y, z, isoLevel, grid, v, corner));
+                        }
+                        mesh.indices.push_back(*id);
+                    }
+                }
+            }
+        }
+    }
+    return mesh;
+}
+
+}
\ No newline at end of file
@@ -1,9 +1,14 @@
+#include "block_summary.hpp"
 #include "grid.hpp"
 #include <array>
+#include <cstdint>
+#include <span>
 #include <vector>
 
 #pragma once
 
+class ThreadPool;
+
 namespace waves_on_cuda::marching_cubes {
 
 namespace geometry {
@@ -24,9 +29,103 @@ struct Triangle {
     }
 };
 
+// Triangles as three indices each into the vertices, which they share
+template<typename dtype>
+struct IndexedMesh {
+    std::vector<Point3D<dtype>> vertices;
+    std::vector<std::uint32_t> indices;
+};
+
 }
 
 std::vector<geometry::Triangle<float>>
 marching_cubes(const GridView<double, 3>& grid, double isoLevel);
 
+// Same triangles, in the same order, meshed by slabs of constant first index
+// on the threads of pool. The order does not depend on the number of threads.
+// Only implemented by our own MC33.
+std::vector<geometry::Triangle<float>>
+marching_cubes(const GridView<double, 3>& grid, double isoLevel,
+               ThreadPool& pool);
+
+// Same triangles, in another order, where the triangles of neighbouring
+// cubes share the vertices on their common edges instead of repeating them
+geometry::IndexedMesh<float>
+marching_cubes_indexed(const GridView<double, 3>& grid, double isoLevel);
+
+// Classification pass of the two-pass marching cubes: the number of triangles
+// of every cube, in the order of the cells in memory, and the exclusive scan of
+// the numbers by rows of cubes along the last axis, followed by the total.
+// The number comes from the configuration of the corners of the cube, and
+// only the ambiguous configurations need the tests that pick their triangles.
+struct CubeCounts {
+    std::vector<unsigned char> triangles;
+    std::vector<std::size_t> row_offsets;
+    std::size_t total() const {
+        return row_offsets.back();
+    }
+};
+CubeCounts count_triangles(const GridView<double, 3>& grid, double isoLevel);
+
+// Fill pass of the two-pass marching cubes: writes the same triangles as the
+// slabs, in the same order, to out, which holds exactly counts.total() of them
+// and may be memory the caller got from elsewhere, like a mapped GL buffer.
+// Only implemented by our own MC33.
+void fill_triangles(const GridView<double, 3>& grid, double isoLevel,
+                    const CubeCounts& counts,
+                    std::span<geometry::Triangle<float>> out);
+
+// Same triangles, in the same order, from a brick-layout grid (only
+// implemented by our own MC33)
+std::vector<geometry::Triangle<float>>
+marching_cubes(const BrickGrid<double, 3>& grid, double isoLevel);
+
+/*
+Mesh of a grid that changes little from one update to the next, kept by blocks
+of block_size^3 cubes: update() re-meshes only the blocks where a value at the
+corners of their cubes changed since the previous grid, found by comparing
+with a copy of it. The copy is in float, the precision the cubes are meshed
+in. Blocks are re-meshed in two passes, like count_triangles and
+fill_triangles, into vectors of the exact size. Block (i, j, k), of the cubes
+from block_size * (i, j, k) on, is numbered in row-major order of (i, j, k).
+Only implemented by our own MC33.
+*/
+class IncrementalMesher {
+public:
+    static constexpr std::size_t block_size = 16;
+
+private:
+    double isoLevel;
+    std::array<std::size_t, 3> _shape{}, _nblocks{};
+    std::vector<float> previous;
+    std::vector<std::vector<geometry::Triangle<float>>> blocks;
+    // Triangles of every cube of the block being re-meshed, see
+    // count_triangles
+    std::vector<unsigned char> block_cubes;
+
+public:
+    explicit IncrementalMesher(double isoLevel = 0.5): isoLevel(isoLevel) {
+    }
+
+    // Re-mesh the blocks that changed and return their indices, in increasing
+    // order. All of them change on the first update and when the shape does.
+    std::vector<std::size_t> update(const GridView<double, 3>& grid);
+
+    std::size_t nb_blocks() const {
+        return blocks.size();
+    }
+    // Same triangles as marching_cubes for the cubes of the block
+    const std::vector<geometry::Triangle<float>>&
+    triangles(std::size_t block) const {
+        return blocks[block];
+    }
+};
+
+// Same triangles, in the same order, without visiting the blocks of cubes that
+// the summary of the grid shows to be on one side of the surface. skipped
+// receives how many blocks that was. Only implemented by our own MC33.
+std::vector<geometry::Triangle<float>>
+marching_cubes(const GridView<double, 3>& grid, double isoLevel,
+               const BlockSummary& blocks, std::size_t* skipped = nullptr);
+
 }
@@ -7,23 +7,38 @@ using Triangle = geometry::Triangle<float>;
 
 class Renderer3D: public MyGLFW {
     float isoLevel;
+#ifdef INCREMENTAL_MARCHING_CUBES
+    // Most of the grid does not change from one frame to the next
+    IncrementalMesher mesher;
+#endif
 
 public:
-    Renderer3D(float isoLevel = 0.5): isoLevel(isoLevel) {
+    Renderer3D(float isoLevel = 0.5)
+        : isoLevel(isoLevel)
+#ifdef INCREMENTAL_MARCHING_CUBES
+        , mesher(isoLevel)
+#endif
+    {
     }
     void set_grid(const GridView<double, 3>& grid) {
-        std::vector<Triangle> triangles = marching_cubes(grid, isoLevel);
-        std::vector<GLfloat> vertex_data;
-        vertex_data.reserve(triangles.size() * 9);
-
-        for(const auto& tri: triangles) {
-            for(const auto& p: tri.corners) {
-                vertex_data.push_back(p.x);
-                vertex_data.push_back(p.y);
-                vertex_data.push_back(p.z);
-            }
-        }
-
-        set_triangles(vertex_data);
+#ifdef INCREMENTAL_MARCHING_CUBES
+        const std::vector<std::size_t> changed = mesher.update(grid);
+        static_assert(sizeof(Triangle) == 9 * sizeof(GLfloat));
+        set_block_triangles(
+            mesher.nb_blocks(), changed, [&](std::size_t block) {
+                const auto& triangles = mesher.triangles(block);
+                return std::span(
+                    reinterpret_cast<const GLfloat*>(triangles.data()),
+                    9 * triangles.size());
+            });
+#else
+        const geometry::IndexedMesh<float> mesh =
+            marching_cubes_indexed(grid, isoLevel);
+        static_assert(sizeof(mesh.vertices[0]) == 3 * sizeof(GLfloat));
+        set_indexed_triangles(
+            std::span(reinterpret_cast<const GLfloat*>(mesh.vertices.data()),
+                      3 * mesh.vertices.size()),
+            mesh.indices);
+#endif
     }
 };
@@ -61,8 +61,8 @@ GRD_wrapper native_to_lib(const GridView<double, 3>& grid) {
 namespace waves_on_cuda::marching_cubes {
 
 using geometry::Triangle;
-std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
-                                            double isoLevel) {
+
+static surface* run(const GridView<double, 3>& grid, double isoLevel) {
     GRD_wrapper Z = native_to_lib(grid);
 
     surface* S;
@@ -75,6 +75,12 @@ std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
             S = calculate_isosurface(&Z.lib_grid, isoLevel);
         }
     }
+    return S;
+}
+
+std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
+                                            double isoLevel) {
+    surface* S = run(grid, isoLevel);
     std::vector<Triangle<float>> result;
 
     // This is also a workaround for the lib, which sets this to -1 if there are
@@ -103,4 +109,28 @@ std::vector<Triangle<float>> marching_cubes(const GridView<double, 3>& grid,
     return result;
 }
 
+geometry::IndexedMesh<float>
+marching_cubes_indexed(const GridView<double, 3>& grid, double isoLevel) {
+    surface* S = run(grid, isoLevel);
+    geometry::IndexedMesh<float> result;
+    if(S->nT == -1)
+        return result;
+
+    // Same order of dimensions as marching_cubes
+    for(int n = 0; n < S->nV; n++) {
+        float* vertex = getVertex(S, n);
+        auto& corner = result.vertices.emplace_back();
+        corner.z = vertex[0];
+        corner.y = vertex[1];
+        corner.x = vertex[2];
+    }
+    for(int n = S->nT; n != 0; n--) {
+        int* t = getTriangle(S, n);
+        result.indices.insert(result.indices.end(), t, t + 3);
+    }
+    free_surface_memory(&S);
+
+    return result;
+}
+
 }
@@ -11,9 +11,9 @@ static geometry::Point3D<float> convert(const ::Vertex& v) {
     return {{v.x, v.y, v.z}};
 }
 
-std::vector<geometry::Triangle<float>>
-marching_cubes(const GridView<double, 3>& grid, double isoLevel) {
-    MarchingCubes mc;
+// Runs mc on grid, with the vertices scaled to the unit cube
+static void run(MarchingCubes& mc, const GridView<double, 3>& grid,
+                double isoLevel) {
     auto shape = grid.shape();
     mc.set_resolution(shape[0], shape[1], shape[2]);
     mc.init_all();
@@ -31,8 +31,6 @@ marching_cubes(const GridView<double, 3>& grid, double isoLevel) {
     }
     mc.clean_temps();
 
-    std::vector<geometry::Triangle<float>> result;
-    ::Triangle* triangles = mc.triangles();
     ::Vertex* vertices = mc.vertices();
     float dx = 1.0 / (grid.shape()[0] - 1);
     float dy = 1.0 / (grid.shape()[1] - 1);
@@ -43,6 +41,16 @@ marching_cubes(const GridView<double, 3>& grid, double isoLevel) {
         v.y *= dy;
         v.z *= dz;
     }
+}
+
+std::vector<geometry::Triangle<float>>
+marching_cubes(const GridView<double, 3>& grid, double isoLevel) {
+    MarchingCubes mc;
+    run(mc, grid, isoLevel);
+
+    std::vector<geometry::Triangle<float>> result;
+    ::Triangle* triangles = mc.triangles();
+    ::Vertex* vertices = mc.vertices();
 
     for(int i = 0; i < mc.ntrigs(); i++) {
         const ::Triangle& tr = triangles[i];
@@ -53,4 +61,24 @@ marching_cubes(const GridView<double, 3>& grid, double isoLevel) {
     return result;
 }
 
+geometry::IndexedMesh<float>
+marching_cubes_indexed(const GridView<double, 3>& grid, double isoLevel) {
+    MarchingCubes mc;
+    run(mc, grid, isoLevel);
+
+    geometry::IndexedMesh<float> result;
+    ::Vertex* vertices = mc.vertices();
+    for(int i = 0; i < mc.nverts(); i++) {
+        result.vertices.push_back(convert(vertices[i]));
+    }
+    ::Triangle* triangles = mc.triangles();
+    for(int i = 0; i < mc.ntrigs(); i++) {
+        const ::Triangle& tr = triangles[i];
+        result.indices.push_back(tr.v1);
+        result.indices.push_back(tr.v2);
+        result.indices.push_back(tr.v3);
+    }
+    return result;
+}
+
 }
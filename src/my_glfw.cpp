@@ -10,6 +10,7 @@
 #include <opencv2/core/mat.hpp>
 #include <opencv2/imgcodecs.hpp>
 #endif
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <filesystem>
@@ -195,6 +196,23 @@ void MyGLFW::initialize() {
     glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4) * 3, nullptr,
                  GL_DYNAMIC_DRAW); // Allocate memory
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, ubo);
+
+    create_buffers();
+}
+
+void MyGLFW::create_buffers() {
+    // The buffers are allocated by set_triangles, set_indexed_triangles and
+    // set_block_triangles
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    // VAO should be bound first, apparently
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+    glBindVertexArray(0);
 }
 
 MyGLFW::~MyGLFW() {
@@ -323,26 +341,109 @@ void Renderer2D::set_grid(const GridView<double, 2>* grid_to_render) {
                             sizeof(triangles) / sizeof(GLfloat)));
 }
 
+// Make room for size bytes in the buffer bound to target, growing its
+// capacity if needed. Reallocating the whole buffer orphans the storage the
+// previous frames may still be drawn from, so that the uploads that follow do
+// not wait for them: the driver hands out fresh storage of the same size.
+static void reallocate(GLenum target, std::size_t& capacity,
+                       std::size_t size) {
+    if(size > capacity)
+        capacity = std::max(size, 2 * capacity);
+    glBufferData(target, capacity, nullptr, GL_DYNAMIC_DRAW);
+}
+
+// Upload size bytes of data to the buffer bound to target
+static void upload(GLenum target, std::size_t& capacity, const void* data,
+                   std::size_t size) {
+    reallocate(target, capacity, size);
+    glBufferSubData(target, 0, size, data);
+}
+
 void MyGLFW::set_triangles(std::span<GLfloat> triangles) {
     nbTriangles = triangles.size() / 9;
-    std::cout << "Displaying " << nbTriangles << " triangles\n";
+    _layout = TRIANGLES;
     // Transfer points to GPU memory
-    GLuint vbo;
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-
-    // VAO should be bound first, apparently
-    glBindVertexArray(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    upload(GL_ARRAY_BUFFER, vbo_capacity, triangles.data(),
+           triangles.size_bytes());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    glBufferData(GL_ARRAY_BUFFER, triangles.size() * sizeof(GLfloat),
-                 triangles.data(), GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+void MyGLFW::set_indexed_triangles(std::span<const GLfloat> vertices,
+                                   std::span<const GLuint> indices) {
+    nbTriangles = indices.size() / 3;
+    _layout = INDEXED;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    upload(GL_ARRAY_BUFFER, vbo_capacity, vertices.data(),
+           vertices.size_bytes());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // The element buffer binding is part of the VAO
+    glBindVertexArray(vao);
+    upload(GL_ELEMENT_ARRAY_BUFFER, ebo_capacity, indices.data(),
+           indices.size_bytes());
     glBindVertexArray(0);
 }
 
+void MyGLFW::set_block_triangles(
+    std::size_t nb_blocks, std::span<const std::size_t> changed,
+    const std::function<std::span<const GLfloat>(std::size_t)>&
+        block_triangles) {
+    constexpr std::size_t vertex_size = 3 * sizeof(GLfloat);
+    // Vertices of room for a block of count vertices: half as many again,
+    // rounded to whole triangles, and at least min_block_room triangles
+    auto room = [](std::size_t count) {
+        return count + std::max(count / 6 * 3, 3 * min_block_room);
+    };
+    bool relayout = _layout != BLOCKS or block_count.size() != nb_blocks;
+    _layout = BLOCKS;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    // Patch the changed blocks in place. A block that outgrew its room moves
+    // to the free end of the buffer, leaving a hole, until the buffer is
+    // full. The draws of the previous frames from the same buffer are waited
+    // for, unlike with a reallocation.
+    for(std::size_t i = 0; not relayout and i < changed.size(); i++) {
+        const std::size_t b = changed[i];
+        const auto triangles = block_triangles(b);
+        const std::size_t count = triangles.size() / 3;
+        if(count > static_cast<std::size_t>(block_capacity[b])) {
+            const std::size_t capacity = room(count);
+            relayout = (blocks_end + capacity) * vertex_size > vbo_capacity;
+            if(relayout)
+                break;
+            block_first[b] = blocks_end;
+            block_capacity[b] = capacity;
+            blocks_end += capacity;
+        }
+        block_count[b] = count;
+        glBufferSubData(GL_ARRAY_BUFFER, block_first[b] * vertex_size,
+                        triangles.size_bytes(), triangles.data());
+    }
+    if(relayout) {
+        // Lay out every block again, without the holes, and leave a third of
+        // the buffer free for the blocks that will move
+        block_first.resize(nb_blocks);
+        block_count.resize(nb_blocks);
+        block_capacity.resize(nb_blocks);
+        blocks_end = 0;
+        for(std::size_t b = 0; b < nb_blocks; b++) {
+            block_count[b] = block_triangles(b).size() / 3;
+            block_first[b] = blocks_end;
+            block_capacity[b] = room(block_count[b]);
+            blocks_end += block_capacity[b];
+        }
+        reallocate(GL_ARRAY_BUFFER, vbo_capacity,
+                   (blocks_end + blocks_end / 2) * vertex_size);
+        for(std::size_t b = 0; b < nb_blocks; b++) {
+            const auto triangles = block_triangles(b);
+            glBufferSubData(GL_ARRAY_BUFFER, block_first[b] * vertex_size,
+                            triangles.size_bytes(), triangles.data());
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    nbTriangles = 0;
+    for(const GLsizei count: block_count) nbTriangles += count / 3;
+}
+
 void MyGLFW::render() {
     processInput();
     glfwPollEvents();
@@ -367,7 +468,14 @@ void MyGLFW::render() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, nbTriangles * 3);
+    if(_layout == INDEXED)
+        glDrawElements(GL_TRIANGLES, nbTriangles * 3, GL_UNSIGNED_INT,
+                       nullptr);
+    else if(_layout == BLOCKS)
+        glMultiDrawArrays(GL_TRIANGLES, block_first.data(),
+                          block_count.data(), block_count.size());
+    else
+        glDrawArrays(GL_TRIANGLES, 0, nbTriangles * 3);
     glBindVertexArray(0);
     glfwSwapBuffers(window);
 }
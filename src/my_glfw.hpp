@@ -2,8 +2,11 @@
 #define MYGLFW_H
 
 #include <GL/glew.h>
+#include <atomic>
+#include <functional>
 #include <glm/mat4x4.hpp>
 #include <span>
+#include <vector>
 
 class GLFWwindow;
 template<class T, size_t dim>
@@ -14,7 +17,8 @@ public:
     enum state { UNINITIALIZED, RUNNING, CLOSED };
 
 protected:
-    state _state = UNINITIALIZED;
+    // signal_should_close() may be called from another thread
+    std::atomic<state> _state = UNINITIALIZED;
     GLFWwindow* window = nullptr;
 
     float yaw = 0, pitch = -45.0f;
@@ -25,9 +29,25 @@ protected:
     int width, height;
     bool first_mouse = true;
     bool clicking_paused = false, clicked_paused = false;
-    std::size_t nbTriangles;
+    std::size_t nbTriangles = 0;
     GLuint vao = 0, ubo;
+    // Vertices and, for indexed meshes, indices of the mesh, kept from one
+    // mesh to the next: the buffers only grow, to the largest mesh so far
+    GLuint vbo = 0, ebo = 0;
+    std::size_t vbo_capacity = 0, ebo_capacity = 0; // In bytes
+    enum layout { TRIANGLES, INDEXED, BLOCKS } _layout = TRIANGLES;
+    // For BLOCKS, the first vertex, number of vertices and room in vertices
+    // of every block in the vertex buffer, and the end of the last block
+    std::vector<GLint> block_first;
+    std::vector<GLsizei> block_count, block_capacity;
+    std::size_t blocks_end = 0;
+    // Least room of a block for the triangles it gains, e.g. when the
+    // surface enters it, in triangles
+    static constexpr std::size_t min_block_room = 16;
 
+    // Create the vertex array and the empty mesh buffers in the current
+    // context, which initialize() makes that of its window
+    void create_buffers();
     void mouse_callback(double xpos, double ypos, bool shift);
     friend void mouse_callback(GLFWwindow* window, double xpos, double ypos);
     void processInput();
@@ -39,6 +59,16 @@ public:
     bool closed() const;
 
     void set_triangles(std::span<GLfloat> triangles);
+    // Triangles as three indices each into the vertices (3 floats each)
+    void set_indexed_triangles(std::span<const GLfloat> vertices,
+                               std::span<const GLuint> indices);
+    // Triangles (9 floats each) by blocks, of which only the changed ones
+    // are uploaded, in place as long as they fit in the room of their block.
+    // block_triangles(b) are the triangles of block b.
+    void set_block_triangles(
+        std::size_t nb_blocks, std::span<const std::size_t> changed,
+        const std::function<std::span<const GLfloat>(std::size_t)>&
+            block_triangles);
     void render();
 };
 
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstddef>
+#include <limits>
+#include <stdexcept>
 #include <utility>
 
 template<typename GridType, unsigned int dim>
@@ -18,8 +22,25 @@ public:
             t += dt;
         }
     }
+    // Largest stable time step from grid, for adaptive time stepping (see
+    // World). Unlimited by default.
+    virtual double max_stable_dt(const GridType&) const {
+        return std::numeric_limits<double>::infinity();
+    }
+    // Whether the step of dt that gave after was stable, for the schemes
+    // whose stability also depends on the state they compute during the step
+    virtual bool stable_step(const GridType&, double) const {
+        return true;
+    }
 };
 
+/*
+Two grids stepped by a scheme in turn. With a fixed time step, every step
+takes dt. With an adaptive one, dt is a cap: every step takes the largest
+step the scheme reports as stable for the current state, up to dt, so that
+quiet phases need fewer steps. A step the scheme finds unstable once taken is
+taken again from the same state with half the time step.
+*/
 template<typename Grid, unsigned int ndim>
 class World {
 public:
@@ -27,20 +48,46 @@ public:
     Grid *current_grid, *other_grid;
     double t = 0;
     double dt;
+    bool adaptive;
+    // Time step of the last step
+    double last_dt = 0;
 
 public:
-    World(std::array<std::size_t, ndim> dims, double dt = 0.01)
-        : grid1(dims), grid2(dims), dt(dt) {
+    World(std::array<std::size_t, ndim> dims, double dt = 0.01,
+          bool adaptive = false)
+        : grid1(dims), grid2(dims), dt(dt), adaptive(adaptive) {
         current_grid = &grid1;
         other_grid = &grid2;
     }
+    // Halvings of an adaptive step before giving up
+    static constexpr int max_retries = 10;
+
     void step(const Scheme<Grid, ndim>& scheme) {
-        scheme.step(*current_grid, *other_grid, t, dt);
+        last_dt = adaptive
+                      ? std::min(dt, scheme.max_stable_dt(*current_grid))
+                      : dt;
+        scheme.step(*current_grid, *other_grid, t, last_dt);
+        for(int retry = 0;
+            adaptive and not scheme.stable_step(*other_grid, last_dt);
+            retry++) {
+            if(retry == max_retries)
+                throw std::runtime_error("No stable time step");
+            last_dt /= 2;
+            scheme.step(*current_grid, *other_grid, t, last_dt);
+        }
         std::swap(current_grid, other_grid);
-        t += dt;
+        t += last_dt;
     }
     void multi_step(unsigned N, const Scheme<Grid, ndim>& scheme) {
+        if(adaptive) {
+            for(unsigned i = 0; i < N; i++) step(scheme);
+            return;
+        }
         scheme.multi_step(N, *current_grid, *other_grid, t, dt);
+        // Like N steps, which leave the result in the other grid for odd N
+        if(N % 2 == 1)
+            std::swap(current_grid, other_grid);
+        last_dt = dt;
         t += N * dt;
     }
     const Grid& grid() const {
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/*
+Bounded ring of snapshots from one producer (the simulation) to one consumer
+(the viewer), where only the latest snapshot matters. The producer writes into
+a slot that is neither the latest one nor the one being read, so it never
+waits for the consumer; the consumer takes the latest snapshot when there is
+a newer one than it last read, and the snapshots it did not get to are
+overwritten instead of queued. Every published snapshot gets the next
+generation number.
+The mutex only guards the slot indices, never the copies themselves.
+*/
+template<typename T, std::size_t N = 3>
+class SnapshotRing {
+    static_assert(N >= 3, "a slot to read, the latest one and one to write");
+    static constexpr std::size_t none = N;
+
+    std::vector<T> slots;
+    std::mutex mutex;
+    // Protected by the mutex
+    std::uint64_t generations[N] = {};
+    std::uint64_t generation = 0;
+    std::size_t latest = none, reading = none, writing = none;
+
+public:
+    // Every slot is constructed from args
+    template<typename... Args>
+    explicit SnapshotRing(const Args&... args) {
+        slots.reserve(N);
+        for(std::size_t i = 0; i < N; i++) slots.emplace_back(args...);
+    }
+    SnapshotRing(const SnapshotRing&) = delete;
+
+    // Slot for the producer to write the next snapshot into, the oldest one
+    // that is free
+    T& acquire() {
+        std::lock_guard lock(mutex);
+        assert(writing == none);
+        for(std::size_t i = 0; i < N; i++) {
+            if(i != latest and i != reading and
+               (writing == none or generations[i] < generations[writing]))
+                writing = i;
+        }
+        return slots[writing];
+    }
+    // Make the acquired slot the latest snapshot, and return its generation
+    std::uint64_t publish() {
+        std::lock_guard lock(mutex);
+        assert(writing != none);
+        latest = writing;
+        writing = none;
+        return generations[latest] = ++generation;
+    }
+
+    // The latest snapshot if it is newer than seen_generation, which is then
+    // updated, or nullptr. The consumer may read the snapshot until its next
+    // call.
+    const T* read_latest(std::uint64_t& seen_generation) {
+        std::lock_guard lock(mutex);
+        if(latest == none or generations[latest] <= seen_generation)
+            return nullptr;
+        reading = latest;
+        seen_generation = generations[reading];
+        return &slots[reading];
+    }
+    // Generation of the latest snapshot, 0 before the first one
+    std::uint64_t latest_generation() {
+        std::lock_guard lock(mutex);
+        return generation;
+    }
+};
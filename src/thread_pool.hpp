@@ -0,0 +1,184 @@
+#pragma once
+
+#include "grid.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+/*
+A fixed-size pool of worker threads that execute one task at a time, in
+lockstep with the calling thread.
+Work is partitioned statically into contiguous chunks (one per thread), so the
+result of a loop never depends on scheduling, only on the thread count.
+parallel_for_dynamic is the exception, for independent tasks of uneven cost.
+*/
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available, work_done;
+    // The task being run, type-erased without std::function so that starting
+    // a task never allocates. Protected by mutex.
+    struct Task {
+        void (*call)(const void* f, unsigned thread_id);
+        const void* f;
+    } task = {nullptr, nullptr};
+    unsigned generation = 0, pending = 0;
+    bool stopping = false;
+    // Per-term results of ordered_sum, kept to avoid allocating every call
+    std::vector<double> sum_terms;
+
+    void worker_main(unsigned thread_id) {
+        unsigned seen_generation = 0;
+        while(true) {
+            Task my_task;
+            {
+                std::unique_lock lock(mutex);
+                work_available.wait(lock, [&]() {
+                    return stopping or generation != seen_generation;
+                });
+                if(stopping)
+                    return;
+                seen_generation = generation;
+                my_task = task;
+            }
+            my_task.call(my_task.f, thread_id);
+            {
+                std::lock_guard lock(mutex);
+                if(--pending == 0)
+                    work_done.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(unsigned nthreads = 1) {
+        // The calling thread is thread 0 and takes part in the work.
+        for(unsigned i = 1; i < std::max(nthreads, 1u); i++) {
+            workers.emplace_back([this, i]() { this->worker_main(i); });
+        }
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for(auto& worker: workers) worker.join();
+    }
+    unsigned size() const {
+        return workers.size() + 1;
+    }
+
+    // Run f(thread_id) once on every thread of the pool, and wait for all of
+    // them to finish.
+    template<typename F>
+    void run(const F& f) {
+        if(workers.empty()) {
+            f(0);
+            return;
+        }
+        {
+            std::lock_guard lock(mutex);
+            task = {[](const void* f, unsigned thread_id) {
+                        (*static_cast<const F*>(f))(thread_id);
+                    },
+                    &f};
+            pending = workers.size();
+            generation++;
+        }
+        work_available.notify_all();
+        f(0);
+        std::unique_lock lock(mutex);
+        work_done.wait(lock, [this]() { return pending == 0; });
+    }
+
+    // Call f(chunk_begin, chunk_end) on contiguous, disjoint chunks covering
+    // [begin, end), or f(chunk_begin, chunk_end, thread_id) if f takes it.
+    // Chunks are in the order of the thread ids.
+    template<typename F>
+    void parallel_for_chunks(std::size_t begin, std::size_t end, F&& f) {
+        const std::size_t nthreads = size(), total = end - begin;
+        run([&](unsigned thread_id) {
+            const std::size_t
+                chunk_begin = begin + total * thread_id / nthreads,
+                chunk_end = begin + total * (thread_id + 1) / nthreads;
+            if(chunk_begin == chunk_end)
+                return;
+            if constexpr(std::is_invocable_v<F&, std::size_t, std::size_t,
+                                             unsigned>)
+                f(chunk_begin, chunk_end, thread_id);
+            else
+                f(chunk_begin, chunk_end);
+        });
+    }
+
+    // Call f(n) for every n in [begin, end), or f(n, thread_id) if f takes
+    // it. Each thread takes the next index as soon as it is done with the
+    // previous one, so that tasks of uneven cost balance out; which thread
+    // runs which index depends on scheduling.
+    template<typename F>
+    void parallel_for_dynamic(std::size_t begin, std::size_t end, F&& f) {
+        std::atomic<std::size_t> next = begin;
+        run([&](unsigned thread_id) {
+            for(std::size_t n; (n = next++) < end;) {
+                if constexpr(std::is_invocable_v<F&, std::size_t, unsigned>)
+                    f(n, thread_id);
+                else
+                    f(n);
+            }
+        });
+    }
+
+    // Sum the values returned by f(n) for n in [0, nterms). Terms are
+    // computed concurrently but always added in order, so the result does not
+    // depend on the number of threads. f must not call ordered_sum itself.
+    template<std::size_t N, typename F>
+    std::array<double, N> ordered_sum(std::size_t nterms, F&& f) {
+        if(sum_terms.size() < nterms * N)
+            sum_terms.resize(nterms * N);
+        parallel_for_chunks(0, nterms, [&](std::size_t begin, std::size_t end) {
+            for(std::size_t n = begin; n < end; n++) {
+                const std::array<double, N> term = f(n);
+                std::copy(term.begin(), term.end(), &sum_terms[n * N]);
+            }
+        });
+        std::array<double, N> result{};
+        for(std::size_t n = 0; n < nterms; n++) {
+            for(std::size_t i = 0; i < N; i++)
+                result[i] += sum_terms[n * N + i];
+        }
+        return result;
+    }
+
+    // Call f(idxs) for every multi-index of the shape. The outermost
+    // dimension is split among threads; each thread then walks its slab in
+    // the same order as ShapeIterator.
+    template<std::size_t dimension, typename F>
+    void for_each_index(const Shape<dimension>& shape, F&& f) {
+        std::size_t inner_size = 1;
+        for(std::size_t dim = 1; dim < dimension; dim++)
+            inner_size *= shape.shape[dim];
+        parallel_for_chunks(
+            0, shape.shape[0], [&](std::size_t row_begin, std::size_t row_end) {
+                std::array<std::size_t, dimension> idxs{};
+                idxs[0] = row_begin;
+                const std::size_t count = (row_end - row_begin) * inner_size;
+                for(std::size_t n = 0; n < count; n++) {
+                    f(static_cast<const std::array<std::size_t, dimension>&>(
+                        idxs));
+                    for(std::size_t dim = dimension; dim-- > 0;) {
+                        if(++idxs[dim] != shape.shape[dim] or dim == 0)
+                            break;
+                        idxs[dim] = 0;
+                    }
+                }
+            });
+    }
+};
@@ -1,7 +1,11 @@
 #ifndef VIEWER_H
 #define VIEWER_H
 
-#include <mutex>
+#include "snapshot_ring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <stdexcept>
 #include <thread>
 
@@ -10,6 +14,12 @@ concept Renders = requires(R r, const Grid& g) {
     { r.set_grid(g) } -> std::same_as<void>;
 };
 
+/*
+Renders grids on a UI thread of its own. render() copies the grid into a
+snapshot and returns: the UI thread meshes a snapshot only when there is a
+newer one than it last rendered, and keeps drawing the previous mesh
+meanwhile, so that the simulation never waits for it (see SnapshotRing).
+*/
 template<class WorldGrid, Renders<WorldGrid> Renderer>
 class Viewer {
 public:
@@ -20,44 +30,46 @@ public:
 
 private:
     Renderer renderer;
+    SnapshotRing<WorldGrid> snapshots;
     std::thread ui_thread;
-    std::mutex mutex;
-    const WorldGrid* grid_to_render = nullptr; // Protected by the mutex
-    bool closed = false;
+    std::atomic<bool> closed = false;
 
 public:
-    Viewer() {
+    // The snapshots are constructed from snapshot_args, e.g. the shape
+    template<typename... Args>
+    explicit Viewer(const Args&... snapshot_args)
+        : snapshots(snapshot_args...) {
         ui_thread = std::thread([this]() { this->thread_main(); });
     }
     ~Viewer() {
         if(ui_thread.joinable()) {
-            {
-                std::lock_guard guard(mutex);
-                renderer.signal_should_close();
-            }
+            renderer.signal_should_close();
             ui_thread.join();
         }
     }
     void thread_main() {
         renderer.initialize();
+        std::uint64_t rendered_generation = 0;
         while(!renderer.closed()) {
-            if(grid_to_render != nullptr) {
-                std::lock_guard guard(mutex);
-                if(grid_to_render != nullptr) { // Double checked locking
-                    renderer.set_grid(*grid_to_render);
-                }
+            const WorldGrid* snapshot =
+                snapshots.read_latest(rendered_generation);
+            if(snapshot != nullptr) {
+                renderer.set_grid(*snapshot);
             }
             renderer.render();
         }
         closed = true;
     }
-    void render(const WorldGrid& grid) {
-        std::lock_guard guard(mutex);
+    // Copy grid, converting its values, into the next snapshot
+    template<typename Grid>
+    void render(const Grid& grid) {
         if(closed) {
             throw WindowClosed();
         }
-        grid_to_render = &grid; // TODO: maybe copy it so we don't render it
-                                // while it's overwritten
+        WorldGrid& snapshot = snapshots.acquire();
+        assert(grid.size() == snapshot.size());
+        std::copy(grid.data(), grid.data() + grid.size(), snapshot.data());
+        snapshots.publish();
     }
 };
 
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+Boundary conditions of the VOF scheme, as a policy for its stencils: interior
+cells run branch-free kernels, and only the cells of the one-cell shell ask the
+policy what lies past the boundary. Another kind of boundary is another policy
+with the same members, passed to VOF.
+*/
+
+// Closed box: nothing flows through the walls, and fields are extended past
+// them by the value of the boundary cell
+struct WallBoundary {
+    // Index read as the neighbour i + d on an axis of n cells
+    static std::size_t neighbour(std::size_t i, int d, std::size_t n) {
+        const std::ptrdiff_t result = static_cast<std::ptrdiff_t>(i) + d;
+        return result < 0 or result >= static_cast<std::ptrdiff_t>(n) ? i
+                                                                      : result;
+    }
+    // Whether index i of an axis of n cells or faces lies on a wall, where
+    // the velocity normal to that axis vanishes
+    static bool at_wall(std::size_t i, std::size_t n) {
+        return i == 0 or i == n - 1;
+    }
+};
@@ -0,0 +1,20 @@
+#pragma once
+
+// Density of a cell, from that of the light phase (volume fraction 0); the
+// heavy phase is denser by 1
+inline double rho(double volume_fraction, double light_density) {
+    return light_density + 1 * volume_fraction;
+}
+
+// Light density for which the heavy phase is density_ratio times denser
+inline double light_density_of_ratio(double density_ratio) {
+    return 1 / (density_ratio - 1);
+}
+
+// 1 / rho on the face between two cells, from the average density
+inline double inverse_face_density(double volume_fraction_a,
+                                   double volume_fraction_b,
+                                   double light_density) {
+    return 2 / (rho(volume_fraction_a, light_density) +
+                rho(volume_fraction_b, light_density));
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "density.hpp"
+#include "scheme.hpp"
+#include "thread_pool.hpp"
+#include "vof.hpp"
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+Many independent simulations run in one process, for parameter sweeps. The
+cases are handed out one at a time to the threads of a pool, so that short
+and long cases balance out, and each thread steps its case with a
+single-threaded scheme of its own, which it keeps from one case to the next
+together with its buffers and pressure solver, unless the density ratio of
+the cases differs, as the pressure solver keeps coefficients of the density.
+The log of the pressure solver, if any, is buffered by case and written
+once all of them ran, in their order, with the name of the case at the
+start of every line.
+*/
+
+struct EnsembleCase {
+    std::string name;
+    std::size_t grid_size = 0;
+    unsigned int steps = 0;
+    double time_step = 0.01;
+    // File of the initial volume fraction, empty for an empty domain
+    std::string input;
+    // Density of the fluid over that of the air, that of rho() by default
+    double density_ratio = 101;
+};
+
+// One case per line: "name size steps time_step [input [density_ratio]]",
+// input being "-" for an empty domain. Empty lines and lines starting with
+// '#' are skipped.
+inline std::vector<EnsembleCase> read_ensemble_cases(std::istream& in) {
+    std::vector<EnsembleCase> cases;
+    std::string line;
+    for(std::size_t line_number = 1; std::getline(in, line); line_number++) {
+        std::istringstream fields(line);
+        EnsembleCase ensemble_case;
+        if(not(fields >> ensemble_case.name) or
+           ensemble_case.name.front() == '#')
+            continue;
+        if(not(fields >> ensemble_case.grid_size >> ensemble_case.steps >>
+               ensemble_case.time_step) or
+           ensemble_case.grid_size == 0)
+            throw std::runtime_error("Invalid ensemble case on line " +
+                                     std::to_string(line_number));
+        if(fields >> ensemble_case.input and ensemble_case.input == "-")
+            ensemble_case.input.clear();
+        if(not(fields >> std::ws).eof() and
+           (not(fields >> ensemble_case.density_ratio) or
+            ensemble_case.density_ratio <= 1))
+            throw std::runtime_error("Invalid ensemble case on line " +
+                                     std::to_string(line_number));
+        cases.push_back(ensemble_case);
+    }
+    return cases;
+}
+
+struct EnsembleResult {
+    unsigned int steps = 0;
+    // Simulated time
+    double t = 0;
+    // Sum of the volume fraction over the cells at the end
+    double mass = 0;
+    double time_ms = 0;
+};
+
+// Run every case from initial_grid(case index), at most nthreads at once,
+// with the pressure solver options but the light density of the case. The
+// results are in the order of the cases.
+template<typename VOF, typename InitialGrid>
+std::vector<EnsembleResult>
+run_ensemble(const std::vector<EnsembleCase>& cases,
+             InitialGrid&& initial_grid, unsigned int nthreads,
+             bool adaptive_time_step = false,
+             const PressureSolverOptions& pressure_solver = {}) {
+    using namespace std::chrono;
+
+    ThreadPool pool(nthreads);
+    // Created by the first case of each thread, logging to the stream of
+    // the thread
+    std::vector<std::unique_ptr<VOF>> schemes(pool.size());
+    std::vector<std::ostringstream> thread_logs(pool.size());
+    std::vector<std::string> case_logs(cases.size());
+    std::vector<EnsembleResult> results(cases.size());
+    pool.parallel_for_dynamic(
+        0, cases.size(), [&](std::size_t n, unsigned thread_id) {
+            const EnsembleCase& ensemble_case = cases[n];
+            auto& scheme = schemes[thread_id];
+            PressureSolverOptions options = pressure_solver;
+            options.light_density =
+                light_density_of_ratio(ensemble_case.density_ratio);
+            if(options.log)
+                options.log = &thread_logs[thread_id];
+            if(not scheme or
+               scheme->pressure_solver_options().light_density !=
+                   options.light_density)
+                scheme = std::make_unique<VOF>(1, options);
+            const auto t1 = steady_clock::now();
+            const std::size_t size = ensemble_case.grid_size;
+            World<typename VOF::Grid, 3> world({size, size, size},
+                                               ensemble_case.time_step,
+                                               adaptive_time_step);
+            const typename VOF::Grid& initial = initial_grid(n);
+            assert(initial.volume_fraction.shape() ==
+                   world.grid().volume_fraction.shape());
+            world.reset(initial);
+            world.multi_step(ensemble_case.steps, *scheme);
+            synchronize();
+            case_logs[n] = thread_logs[thread_id].str();
+            thread_logs[thread_id].str("");
+
+            EnsembleResult& result = results[n];
+            result.steps = ensemble_case.steps;
+            result.t = world.t;
+            const auto& volume_fraction = world.grid().volume_fraction;
+            for(std::size_t i = 0; i < volume_fraction.size(); i++)
+                result.mass += volume_fraction.data()[i];
+            result.time_ms =
+                duration<double, std::milli>(steady_clock::now() - t1)
+                    .count();
+        });
+    if(pressure_solver.log) {
+        for(std::size_t n = 0; n < cases.size(); n++) {
+            std::istringstream lines(case_logs[n]);
+            for(std::string line; std::getline(lines, line);)
+                *pressure_solver.log << cases[n].name << ',' << line << '\n';
+        }
+    }
+    return results;
+}
@@ -6,6 +6,15 @@ std::tuple<std::array<double, 12>, std::array<bool, 12>>
 get_intersect(double volume_fraction, std::span<double, 3> normal);
 std::tuple<std::array<double, 3>, std::array<double, 3>>
 get_wall_sizes(double volume_fraction, std::span<double, 3> normal);
+// get_wall_sizes of many cells at once, in structure-of-arrays layout: cell n
+// has the volume fraction volume_fraction[n] and the normal normal[dim][n].
+// Vectorized with AVX or AVX-512 when compiled for them (see NATIVE_ARCH).
+void get_wall_sizes(std::span<const double> volume_fraction,
+                    const std::array<std::span<const double>, 3>& normal,
+                    const std::array<std::span<double>, 3>& wall_sizes_early,
+                    const std::array<std::span<double>, 3>& wall_sizes_late);
+// Instruction set used by the batched get_wall_sizes
+const char* wall_sizes_instruction_set();
 
 extern const std::array<std::array<double, 3>, 12> baselines;
 extern const std::array<unsigned int, 12> switching_dim;
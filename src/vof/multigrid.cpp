@@ -0,0 +1,305 @@
+#include "multigrid.hpp"
+#include "density.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace {
+
+std::array<std::size_t, 3> strides_of(const std::array<std::size_t, 3>& shape) {
+    return {shape[1] * shape[2], shape[2], 1};
+}
+
+// Sum of coeff * x over the neighbours of cell c = (i, j, k)
+inline double neighbour_sum(const Multigrid::Level& level, const double* x,
+                            const std::array<std::size_t, 3>& idxs,
+                            std::size_t c) {
+    const auto stride = strides_of(level.shape);
+    double result = 0.0;
+    for(int dim = 0; dim < 3; dim++) {
+        const double* coeff = level.coeff[dim].data();
+        if(idxs[dim] != 0)
+            result += coeff[c - stride[dim]] * x[c - stride[dim]];
+        if(idxs[dim] != level.shape[dim] - 1)
+            result += coeff[c] * x[c + stride[dim]];
+    }
+    return result;
+}
+
+// Call f(i, j, k, c) on every cell of the plane i
+template<typename F>
+void for_each_cell_of_plane(const std::array<std::size_t, 3>& shape,
+                            std::size_t i, F&& f) {
+    std::size_t c = i * shape[1] * shape[2];
+    for(std::size_t j = 0; j < shape[1]; j++) {
+        for(std::size_t k = 0; k < shape[2]; k++, c++) {
+            f(std::array<std::size_t, 3>{i, j, k}, c);
+        }
+    }
+}
+
+template<typename F>
+void for_each_plane(ThreadPool& pool, std::size_t nplanes, F&& f) {
+    pool.parallel_for_chunks(0, nplanes,
+                             [&](std::size_t begin, std::size_t end) {
+                                 for(std::size_t i = begin; i < end; i++) f(i);
+                             });
+}
+
+}
+
+Multigrid::Level::Level(std::array<std::size_t, 3> shape, bool finest)
+    : shape(shape), coeff{shape, shape, shape}, diagonal(shape),
+      x(finest ? std::array<std::size_t, 3>{0, 0, 0} : shape),
+      b(finest ? std::array<std::size_t, 3>{0, 0, 0} : shape), r(shape) {
+}
+
+Multigrid::Multigrid(std::array<std::size_t, 3> shape) {
+    std::size_t nb_levels = 1;
+    for(auto s = shape; std::ranges::min(s) > 2; nb_levels++) {
+        for(auto& n: s) n = (n + 1) / 2;
+    }
+    levels.reserve(nb_levels);
+    levels.emplace_back(shape, true);
+    while(levels.size() < nb_levels) {
+        for(auto& n: shape) n = (n + 1) / 2;
+        levels.emplace_back(shape, false);
+    }
+}
+
+Multigrid::Multigrid(const PoissonOperator& A, ThreadPool& pool)
+    : Multigrid(std::array<std::size_t, 3>{A.volume_fraction.shape()[0],
+                                           A.volume_fraction.shape()[1],
+                                           A.volume_fraction.shape()[2]}) {
+    update(A, pool);
+}
+
+void Multigrid::update(const PoissonOperator& A, ThreadPool& pool) {
+    const auto& vf = A.volume_fraction;
+    {
+        Level& finest = levels.front();
+        const auto& shape = finest.shape;
+        assert(std::equal(shape.begin(), shape.end(), vf.shape().begin()));
+        const auto stride = strides_of(shape);
+        for_each_plane(pool, shape[0], [&](std::size_t i) {
+            for_each_cell_of_plane(shape, i, [&](const auto& idxs,
+                                                 std::size_t c) {
+                for(int dim = 0; dim < 3; dim++) {
+                    finest.coeff[dim].data()[c] =
+                        idxs[dim] == shape[dim] - 1
+                            ? 0.0
+                            : inverse_face_density(vf.data()[c],
+                                                   vf.data()[c + stride[dim]],
+                                                   A.light_density) /
+                                  (A.dx[dim] * A.dx[dim]);
+                }
+            });
+        });
+    }
+
+    for(std::size_t l = 1; l < levels.size(); l++) {
+        const Level& fine = levels[l - 1];
+        Level& coarse = levels[l];
+        const auto& coarse_shape = coarse.shape;
+        const auto fine_stride = strides_of(fine.shape);
+        for_each_plane(pool, coarse_shape[0], [&](std::size_t i) {
+            for_each_cell_of_plane(coarse_shape, i, [&](const auto& idxs,
+                                                         std::size_t c) {
+                for(int dim = 0; dim < 3; dim++) {
+                    if(idxs[dim] == coarse_shape[dim] - 1) {
+                        coarse.coeff[dim].data()[c] = 0.0;
+                        continue;
+                    }
+                    // The fine faces on this coarse face are between the
+                    // fine cells 2I+1 and 2I+2 along dim, for all the
+                    // children of the coarse cell along the other axes.
+                    double sum = 0.0;
+                    int count = 0;
+                    for(int child = 0; child < 4; child++) {
+                        std::array<std::size_t, 3> fine_idxs;
+                        int bit = 0;
+                        for(int d = 0; d < 3; d++) {
+                            fine_idxs[d] = 2 * idxs[d];
+                            fine_idxs[d] +=
+                                d == dim ? 1 : (child >> bit++) & 1;
+                        }
+                        if(fine_idxs[0] >= fine.shape[0] or
+                           fine_idxs[1] >= fine.shape[1] or
+                           fine_idxs[2] >= fine.shape[2])
+                            continue;
+                        const std::size_t f = fine_idxs[0] * fine_stride[0] +
+                                              fine_idxs[1] * fine_stride[1] +
+                                              fine_idxs[2];
+                        sum += fine.coeff[dim].data()[f];
+                        count++;
+                    }
+                    // Average, and account for the cell size doubling
+                    coarse.coeff[dim].data()[c] = sum / count / 4;
+                }
+            });
+        });
+    }
+
+    for(Level& level: levels) {
+        const auto stride = strides_of(level.shape);
+        for_each_plane(pool, level.shape[0], [&](std::size_t i) {
+            for_each_cell_of_plane(level.shape, i, [&](const auto& idxs,
+                                                       std::size_t c) {
+                double diagonal = 0.0;
+                for(int dim = 0; dim < 3; dim++) {
+                    diagonal += level.coeff[dim].data()[c];
+                    if(idxs[dim] != 0)
+                        diagonal += level.coeff[dim].data()[c - stride[dim]];
+                }
+                level.diagonal.data()[c] = diagonal;
+            });
+        });
+    }
+}
+
+void Multigrid::smooth(const Level& level, double* x, const double* b,
+                       int color, ThreadPool& pool) const {
+    // Cells of one colour only have neighbours of the other colour, so they
+    // can all be updated concurrently.
+    for_each_plane(pool, level.shape[0], [&](std::size_t i) {
+        const auto stride = strides_of(level.shape);
+        for(std::size_t j = 0; j < level.shape[1]; j++) {
+            for(std::size_t k = (i + j + color) % 2; k < level.shape[2];
+                k += 2) {
+                const std::size_t c = i * stride[0] + j * stride[1] + k;
+                const double diagonal = level.diagonal.data()[c];
+                if(diagonal != 0) {
+                    x[c] = (b[c] + neighbour_sum(level, x, {i, j, k}, c)) /
+                           diagonal;
+                }
+            }
+        }
+    });
+}
+
+void Multigrid::residual(const Level& level, const double* x, const double* b,
+                         double* r, ThreadPool& pool) const {
+    for_each_plane(pool, level.shape[0], [&](std::size_t i) {
+        for_each_cell_of_plane(level.shape, i, [&](const auto& idxs,
+                                                   std::size_t c) {
+            r[c] = b[c] - (level.diagonal.data()[c] * x[c] -
+                           neighbour_sum(level, x, idxs, c));
+        });
+    });
+}
+
+void Multigrid::v_cycle(std::size_t l, double* x, const double* b,
+                        ThreadPool& pool) const {
+    const Level& level = levels[l];
+    if(l + 1 == levels.size()) {
+        for(unsigned int sweep = 0; sweep < coarsest_sweeps; sweep++) {
+            smooth(level, x, b, 0, pool);
+            smooth(level, x, b, 1, pool);
+        }
+        return;
+    }
+
+    for(unsigned int step = 0; step < smoothing_steps; step++) {
+        smooth(level, x, b, 0, pool);
+        smooth(level, x, b, 1, pool);
+    }
+
+    const Level& coarse = levels[l + 1];
+    residual(level, x, b, level.r.data(), pool);
+    const auto fine_stride = strides_of(level.shape);
+    for_each_plane(pool, coarse.shape[0], [&](std::size_t i) {
+        for_each_cell_of_plane(coarse.shape, i, [&](const auto& idxs,
+                                                    std::size_t c) {
+            double sum = 0.0;
+            int count = 0;
+            for(int child = 0; child < 8; child++) {
+                const std::array<std::size_t, 3> fine_idxs = {
+                    2 * idxs[0] + ((child >> 2) & 1),
+                    2 * idxs[1] + ((child >> 1) & 1),
+                    2 * idxs[2] + (child & 1)};
+                if(fine_idxs[0] >= level.shape[0] or
+                   fine_idxs[1] >= level.shape[1] or
+                   fine_idxs[2] >= level.shape[2])
+                    continue;
+                sum += level.r.data()[fine_idxs[0] * fine_stride[0] +
+                                      fine_idxs[1] * fine_stride[1] +
+                                      fine_idxs[2]];
+                count++;
+            }
+            coarse.b.data()[c] = sum / count;
+            coarse.x.data()[c] = 0.0;
+        });
+    });
+
+    v_cycle(l + 1, coarse.x.data(), coarse.b.data(), pool);
+
+    const auto coarse_stride = strides_of(coarse.shape);
+    for_each_plane(pool, level.shape[0], [&](std::size_t i) {
+        for_each_cell_of_plane(level.shape, i, [&](const auto& idxs,
+                                                   std::size_t c) {
+            x[c] += coarse.x.data()[(idxs[0] / 2) * coarse_stride[0] +
+                                    (idxs[1] / 2) * coarse_stride[1] +
+                                    idxs[2] / 2];
+        });
+    });
+
+    for(unsigned int step = 0; step < smoothing_steps; step++) {
+        smooth(level, x, b, 1, pool);
+        smooth(level, x, b, 0, pool);
+    }
+}
+
+PressureSolverStats Multigrid::solve(const GridView<double, 3>& b,
+                                     GridView<double, 3>& x,
+                                     const PressureSolverOptions& options,
+                                     ThreadPool& pool) const {
+    const Level& finest = levels.front();
+    const std::size_t plane_size = finest.shape[1] * finest.shape[2];
+    auto residual_norm2 = [&]() {
+        residual(finest, x.data(), b.data(), finest.r.data(), pool);
+        return pool.ordered_sum<1>(finest.shape[0], [&](std::size_t i) {
+            double rr = 0;
+            for(std::size_t c = i * plane_size; c < (i + 1) * plane_size; c++)
+                rr += finest.r.data()[c] * finest.r.data()[c];
+            return std::array<double, 1>{rr};
+        })[0];
+    };
+    const double rhs_norm2 =
+        pool.ordered_sum<1>(finest.shape[0], [&](std::size_t i) {
+            double bb = 0;
+            for(std::size_t c = i * plane_size; c < (i + 1) * plane_size; c++)
+                bb += b.data()[c] * b.data()[c];
+            return std::array<double, 1>{bb};
+        })[0];
+    if(rhs_norm2 == 0) {
+        std::fill(x.data(), x.data() + x.size(), 0.0);
+        return {0, 0};
+    }
+    const unsigned int max_cycles =
+        options.max_iterations != 0
+            ? options.max_iterations
+            : PressureSolverOptions::default_multigrid_cycles;
+    const double threshold = options.tolerance * options.tolerance * rhs_norm2;
+
+    double rr = residual_norm2();
+    unsigned int cycle = 0;
+    while(rr >= threshold and cycle < max_cycles) {
+        v_cycle(0, x.data(), b.data(), pool);
+        rr = residual_norm2();
+        cycle++;
+    }
+    return {cycle, std::sqrt(rr / rhs_norm2)};
+}
+
+double Multigrid::apply(const GridView<double, 3>& r, GridView<double, 3>& z,
+                        ThreadPool& pool) const {
+    std::fill(z.data(), z.data() + z.size(), 0.0);
+    v_cycle(0, z.data(), r.data(), pool);
+    const std::size_t plane_size = r.size() / r.shape()[0];
+    return pool.ordered_sum<1>(r.shape()[0], [&](std::size_t i) {
+        double rz = 0;
+        for(std::size_t c = i * plane_size; c < (i + 1) * plane_size; c++)
+            rz += r.data()[c] * z.data()[c];
+        return std::array<double, 1>{rz};
+    })[0];
+}
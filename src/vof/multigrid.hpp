@@ -0,0 +1,74 @@
+#pragma once
+
+#include "grid.hpp"
+#include "pressure_solver.hpp"
+#include "thread_pool.hpp"
+#include <array>
+#include <vector>
+
+/*
+Geometric multigrid for the pressure Poisson equation (see PoissonOperator).
+
+Each level halves the number of cells along every axis (rounding up). The
+coarse face coefficients are not rediscretized from a coarsened volume
+fraction, which would smear the density jump: each coarse face takes the
+average of the 1/rho coefficients of the fine faces it covers (conductances in
+parallel), scaled for the doubled cell size.
+
+One V-cycle uses red-black Gauss-Seidel smoothing, restriction by averaging and
+piecewise-constant prolongation. Post-smoothing visits the colours in the
+opposite order to pre-smoothing, which keeps the V-cycle symmetric so that it
+can precondition CG.
+*/
+class Multigrid: public Preconditioner {
+public:
+    struct Level {
+        std::array<std::size_t, 3> shape;
+        // Coefficient of the face between a cell and its neighbour in +dim
+        // (zero on the last layer, where there is no neighbour)
+        Grid<double, 3> coeff[3];
+        Grid<double, 3> diagonal;
+        // Solution, right-hand side and residual of the coarse problems
+        // (level 0 solves in the caller's grids, and only uses the residual)
+        mutable Grid<double, 3> x, b, r;
+
+        Level(std::array<std::size_t, 3> shape, bool finest);
+    };
+
+    static constexpr unsigned int smoothing_steps = 2;
+    static constexpr unsigned int coarsest_sweeps = 50;
+
+private:
+    std::vector<Level> levels;
+
+    void smooth(const Level& level, double* x, const double* b, int color,
+                ThreadPool& pool) const;
+    void residual(const Level& level, const double* x, const double* b,
+                  double* r, ThreadPool& pool) const;
+    void v_cycle(std::size_t l, double* x, const double* b,
+                 ThreadPool& pool) const;
+
+public:
+    // Allocate the levels for a grid of the given shape; update() must be
+    // called before using it.
+    explicit Multigrid(std::array<std::size_t, 3> shape);
+    Multigrid(const PoissonOperator& A, ThreadPool& pool);
+
+    // Recompute the coefficients of all the levels from A
+    void update(const PoissonOperator& A, ThreadPool& pool) override;
+
+    std::size_t nb_levels() const {
+        return levels.size();
+    }
+
+    // Standalone solver: V-cycles on x (which contains the initial guess)
+    // until the relative residual reaches the tolerance.
+    PressureSolverStats solve(const GridView<double, 3>& b,
+                              GridView<double, 3>& x,
+                              const PressureSolverOptions& options,
+                              ThreadPool& pool) const;
+
+    // One V-cycle from a zero initial guess
+    double apply(const GridView<double, 3>& r, GridView<double, 3>& z,
+                 ThreadPool& pool) const override;
+};
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "grid.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+/*
+Normals of the interface with Mixed Young Centered: the gradient of the
+(clamped) volume fraction with a 27-point stencil of weights 4, 2 and 1 for
+the face, edge and corner neighbours.
+The weights are separable: the component along an axis is a [-1, 0, 1]
+difference along that axis, smoothed by [1, 2, 1] along the two others. Both
+versions below evaluate it with the same partial sums in the same order, so
+they give identical normals.
+*/
+
+// Point the stencil sum out of the fluid, with unit length
+inline std::array<double, 3> normalize_normal(std::array<double, 3> normal) {
+    double normal_norm =
+        std::sqrt(std::pow(normal[0], 2) + std::pow(normal[1], 2) +
+                  std::pow(normal[2], 2));
+    if(normal_norm == 0) {
+        normal[0] = 1.0; // Just set a random nonzero vector
+    } else {
+        for(int dim = 0; dim < 3; dim++) {
+            normal[dim] = -normal[dim] / normal_norm;
+            assert(not std::isnan(normal[dim]));
+        }
+    }
+    return normal;
+}
+
+// Normal of one cell. volume_fraction(di, dj, dk) is the volume fraction of
+// the neighbour at that offset, as given by the boundary conditions.
+template<typename F>
+std::array<double, 3> mixed_young_centered(F&& volume_fraction) {
+    // Along the last axis
+    double sz[3][3], dz[3][3];
+    for(int di = -1; di <= 1; di++) {
+        for(int dj = -1; dj <= 1; dj++) {
+            const double below =
+                std::clamp<double>(volume_fraction(di, dj, -1), 0.0, 1.0);
+            const double center =
+                std::clamp<double>(volume_fraction(di, dj, 0), 0.0, 1.0);
+            const double above =
+                std::clamp<double>(volume_fraction(di, dj, 1), 0.0, 1.0);
+            sz[di + 1][dj + 1] = below + 2 * center + above;
+            dz[di + 1][dj + 1] = above - below;
+        }
+    }
+    // Along the middle axis
+    double syz[3], dysz[3], sydz[3];
+    for(int i = 0; i < 3; i++) {
+        syz[i] = sz[i][0] + 2 * sz[i][1] + sz[i][2];
+        dysz[i] = sz[i][2] - sz[i][0];
+        sydz[i] = dz[i][0] + 2 * dz[i][1] + dz[i][2];
+    }
+    // Along the first axis
+    return normalize_normal({syz[2] - syz[0],
+                             dysz[0] + 2 * dysz[1] + dysz[2],
+                             sydz[0] + 2 * sydz[1] + sydz[2]});
+}
+
+/*
+Normals of the cells of a tile (at most size cells along each axis).
+load() clamps the volume fraction once into a copy of the tile with a ghost
+layer, and sums it along the last two axes with passes over whole rows, so
+that the partial sums are shared by neighbouring cells and the loops
+vectorize. normal() only does the sum along the first axis. Keeps its buffers
+between tiles.
+*/
+template<typename Boundary>
+class MixedYoungCenteredTile {
+    std::array<std::size_t, 3> begin{}, n{};
+    std::vector<double> values, sz, dz, syz, dysz, sydz;
+
+public:
+    static constexpr std::size_t size = 8;
+
+    template<typename T>
+    void load(const GridView<T, 3>& volume_fraction,
+              const std::array<std::size_t, 3>& tile_begin) {
+        const auto& shape = volume_fraction.shape();
+        begin = tile_begin;
+        std::array<std::size_t, 3> g;
+        for(int dim = 0; dim < 3; dim++) {
+            assert(begin[dim] < shape[dim]);
+            n[dim] = std::min(size, shape[dim] - begin[dim]);
+            g[dim] = n[dim] + 2;
+        }
+        values.resize(g[0] * g[1] * g[2]);
+        sz.resize(g[0] * g[1] * n[2]);
+        dz.resize(sz.size());
+        syz.resize(g[0] * n[1] * n[2]);
+        dysz.resize(syz.size());
+        sydz.resize(syz.size());
+
+        // Index in the grid of position p of the copy along dim
+        auto source = [&](int dim, std::size_t p) {
+            if(p == 0)
+                return Boundary::neighbour(begin[dim], -1, shape[dim]);
+            if(p == n[dim] + 1)
+                return Boundary::neighbour(begin[dim] + n[dim] - 1, 1,
+                                           shape[dim]);
+            return begin[dim] + p - 1;
+        };
+        const T* vf = volume_fraction.data();
+        const std::size_t first = source(2, 0), last = source(2, n[2] + 1);
+        for(std::size_t a = 0; a < g[0]; a++) {
+            for(std::size_t b = 0; b < g[1]; b++) {
+                const T* row =
+                    vf + (source(0, a) * shape[1] + source(1, b)) * shape[2];
+                double* dst = &values[(a * g[1] + b) * g[2]];
+                dst[0] = std::clamp<double>(row[first], 0.0, 1.0);
+                for(std::size_t c = 0; c < n[2]; c++)
+                    dst[c + 1] =
+                        std::clamp<double>(row[begin[2] + c], 0.0, 1.0);
+                dst[n[2] + 1] = std::clamp<double>(row[last], 0.0, 1.0);
+            }
+        }
+        // Along the last axis
+        const std::ptrdiff_t up = n[2];
+        for(std::size_t ab = 0; ab < g[0] * g[1]; ab++) {
+            const double* v = &values[ab * g[2] + 1];
+            double* s = &sz[ab * n[2]];
+            double* d = &dz[ab * n[2]];
+            for(std::ptrdiff_t c = 0; c < up; c++) {
+                s[c] = v[c - 1] + 2 * v[c] + v[c + 1];
+                d[c] = v[c + 1] - v[c - 1];
+            }
+        }
+        // Along the middle axis
+        for(std::size_t a = 0; a < g[0]; a++) {
+            for(std::size_t b = 0; b < n[1]; b++) {
+                const std::size_t row = (a * g[1] + b + 1) * n[2],
+                                  out = (a * n[1] + b) * n[2];
+                const double *s = &sz[row], *d = &dz[row];
+                for(std::ptrdiff_t c = 0; c < up; c++) {
+                    syz[out + c] = s[c - up] + 2 * s[c] + s[c + up];
+                    dysz[out + c] = s[c + up] - s[c - up];
+                    sydz[out + c] = d[c - up] + 2 * d[c] + d[c + up];
+                }
+            }
+        }
+    }
+
+    // Normal of a cell of the loaded tile, given by its index in the grid
+    std::array<double, 3>
+    normal(const std::array<std::size_t, 3>& idxs) const {
+        for(int dim = 0; dim < 3; dim++)
+            assert(begin[dim] <= idxs[dim] and idxs[dim] < begin[dim] + n[dim]);
+        // Along the first axis
+        const std::size_t plane = n[1] * n[2],
+                          x = ((idxs[0] - begin[0] + 1) * n[1] + idxs[1] -
+                               begin[1]) * n[2] + idxs[2] - begin[2];
+        return normalize_normal(
+            {syz[x + plane] - syz[x - plane],
+             dysz[x - plane] + 2 * dysz[x] + dysz[x + plane],
+             sydz[x - plane] + 2 * sydz[x] + sydz[x + plane]});
+    }
+};
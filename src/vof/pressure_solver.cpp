@@ -0,0 +1,506 @@
+#include "pressure_solver.hpp"
+#include "density.hpp"
+#include "multigrid.hpp"
+#include <Eigen/IterativeLinearSolvers>
+#include <Eigen/SparseCore>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+#include <ostream>
+#include <span>
+
+namespace {
+
+std::array<std::size_t, 3> dims_of(const GridView<double, 3>& grid) {
+    return {grid.shape()[0], grid.shape()[1], grid.shape()[2]};
+}
+
+// out[k] += w(a[k], b[k]) * (p[k] - q[k]) for k in [0, n), where w is the
+// coefficient of the face between two cells with volume fractions a and b
+inline void add_face_terms(const double* vf_a, const double* vf_b,
+                           const double* p, const double* q, double* out,
+                           std::size_t n, double inv_dx2,
+                           double light_density) {
+    for(std::size_t k = 0; k < n; k++) {
+        out[k] += inverse_face_density(vf_a[k], vf_b[k], light_density) *
+                  inv_dx2 * (p[k] - q[k]);
+    }
+}
+
+// Apply the operator on plane i, and return the dot product of p and A p on
+// that plane.
+// Each kind of face is handled by its own loop over a row, so that the loops
+// have no boundary branches and can be vectorized.
+double apply_on_plane(const PoissonOperator& A, const double* p, double* out,
+                      std::size_t i) {
+    const double* vf = A.volume_fraction.data();
+    const auto& shape = A.volume_fraction.shape();
+    const std::size_t nrows = shape[1], row_size = shape[2];
+    const std::array<std::size_t, 3> stride = {nrows * row_size, row_size, 1};
+    std::array<double, 3> inv_dx2;
+    for(int dim = 0; dim < 3; dim++) inv_dx2[dim] = 1 / (A.dx[dim] * A.dx[dim]);
+
+    double dot = 0.0;
+    for(std::size_t j = 0; j < nrows; j++) {
+        const std::size_t c = i * stride[0] + j * stride[1];
+        std::fill(out + c, out + c + row_size, 0.0);
+        const std::array<std::size_t, 2> idxs = {i, j};
+        const std::array<std::size_t, 2> sizes = {shape[0], nrows};
+        for(int dim = 0; dim < 2; dim++) {
+            if(idxs[dim] != 0) {
+                const std::size_t nb = c - stride[dim];
+                add_face_terms(vf + c, vf + nb, p + c, p + nb, out + c,
+                               row_size, inv_dx2[dim], A.light_density);
+            }
+            if(idxs[dim] != sizes[dim] - 1) {
+                const std::size_t nb = c + stride[dim];
+                add_face_terms(vf + c, vf + nb, p + c, p + nb, out + c,
+                               row_size, inv_dx2[dim], A.light_density);
+            }
+        }
+        if(row_size > 1) {
+            // Faces along the row: the cell before, then the cell after
+            add_face_terms(vf + c + 1, vf + c, p + c + 1, p + c, out + c + 1,
+                           row_size - 1, inv_dx2[2], A.light_density);
+            add_face_terms(vf + c, vf + c + 1, p + c, p + c + 1, out + c,
+                           row_size - 1, inv_dx2[2], A.light_density);
+        }
+        for(std::size_t k = c; k < c + row_size; k++) dot += p[k] * out[k];
+    }
+    return dot;
+}
+
+}
+
+void PoissonOperator::apply(const GridView<double, 3>& p,
+                            GridView<double, 3>& out, ThreadPool& pool) const {
+    assert(p.shape() == volume_fraction.shape());
+    assert(out.shape() == volume_fraction.shape());
+    pool.parallel_for_chunks(
+        0, volume_fraction.shape()[0], [&](std::size_t begin, std::size_t end) {
+            for(std::size_t i = begin; i < end; i++)
+                apply_on_plane(*this, p.data(), out.data(), i);
+        });
+}
+
+void PoissonOperator::diagonal(GridView<double, 3>& out,
+                               ThreadPool& pool) const {
+    const double* vf = volume_fraction.data();
+    const auto& shape = volume_fraction.shape();
+    const std::array<std::size_t, 3> stride = {shape[1] * shape[2], shape[2],
+                                               1};
+    pool.for_each_index(volume_fraction.indices(), [&](const auto& idxs) {
+        const std::size_t c = volume_fraction.idx_to_offset(idxs);
+        double result = 0.0;
+        for(int dim = 0; dim < 3; dim++) {
+            const double inv_dx2 = 1 / (dx[dim] * dx[dim]);
+            if(idxs[dim] != 0) {
+                result += inverse_face_density(vf[c], vf[c - stride[dim]],
+                                               light_density) *
+                          inv_dx2;
+            }
+            if(idxs[dim] != shape[dim] - 1) {
+                result += inverse_face_density(vf[c], vf[c + stride[dim]],
+                                               light_density) *
+                          inv_dx2;
+            }
+        }
+        out[idxs] = result;
+    });
+}
+
+JacobiPreconditioner::JacobiPreconditioner(const PoissonOperator& A,
+                                           ThreadPool& pool)
+    : inverse_diagonal(dims_of(A.volume_fraction)) {
+    update(A, pool);
+}
+
+void JacobiPreconditioner::update(const PoissonOperator& A, ThreadPool& pool) {
+    A.diagonal(inverse_diagonal, pool);
+    // Same as Eigen's DiagonalPreconditioner
+    for(double& element:
+        std::span(inverse_diagonal.data(), inverse_diagonal.size())) {
+        element = element != 0 ? 1 / element : 1;
+    }
+}
+
+double JacobiPreconditioner::apply(const GridView<double, 3>& r,
+                                   GridView<double, 3>& z,
+                                   ThreadPool& pool) const {
+    const std::size_t plane_size = r.size() / r.shape()[0];
+    return pool.ordered_sum<1>(r.shape()[0], [&](std::size_t i) {
+        double rz = 0;
+        for(std::size_t c = i * plane_size; c < (i + 1) * plane_size; c++) {
+            z.data()[c] = inverse_diagonal.data()[c] * r.data()[c];
+            rz += r.data()[c] * z.data()[c];
+        }
+        return std::array<double, 1>{rz};
+    })[0];
+}
+
+/*
+Same algorithm as Eigen::ConjugateGradient, so that both paths can be compared
+iteration by iteration when using the JacobiPreconditioner (Eigen's default).
+Element-wise updates are fused with the dot products that follow them to save
+passes over memory.
+*/
+PressureSolverStats conjugate_gradient(const PoissonOperator& A,
+                                       const GridView<double, 3>& b,
+                                       GridView<double, 3>& x,
+                                       const PressureSolverOptions& options,
+                                       const Preconditioner& preconditioner,
+                                       ConjugateGradientWorkspace& workspace,
+                                       ThreadPool& pool) {
+    const auto dims = dims_of(b);
+    const std::size_t nplanes = dims[0], plane_size = dims[1] * dims[2];
+    const unsigned int max_iterations = options.max_iterations != 0
+                                            ? options.max_iterations
+                                            : 2 * b.size();
+    auto& [r, z, d, q] = workspace;
+    assert(r.shape() == dims);
+
+    // r = b - A x
+    A.apply(x, q, pool);
+    const auto [rhs_norm2, residual_norm2_initial] = pool.ordered_sum<2>(
+        nplanes, [&](std::size_t i) -> std::array<double, 2> {
+            double bb = 0, rr = 0;
+            for(std::size_t c = i * plane_size; c < (i + 1) * plane_size; c++) {
+                r.data()[c] = b.data()[c] - q.data()[c];
+                bb += b.data()[c] * b.data()[c];
+                rr += r.data()[c] * r.data()[c];
+            }
+            return {bb, rr};
+        });
+    if(rhs_norm2 == 0) {
+        std::fill(x.data(), x.data() + x.size(), 0.0);
+        return {0, 0};
+    }
+    const double threshold =
+        std::max(options.tolerance * options.tolerance * rhs_norm2,
+                 std::numeric_limits<double>::min());
+    double residual_norm2 = residual_norm2_initial;
+    if(residual_norm2 < threshold) {
+        return {0, std::sqrt(residual_norm2 / rhs_norm2)};
+    }
+
+    double abs_new = preconditioner.apply(r, d, pool);
+
+    unsigned int iteration = 0;
+    while(iteration < max_iterations) {
+        // q = A d
+        const double dq = pool.ordered_sum<1>(nplanes, [&](std::size_t i) {
+            return std::array<double, 1>{
+                apply_on_plane(A, d.data(), q.data(), i)};
+        })[0];
+        const double alpha = abs_new / dq;
+        // x += alpha d, r -= alpha q
+        residual_norm2 = pool.ordered_sum<1>(nplanes, [&](std::size_t i) {
+            double rr = 0;
+            for(std::size_t c = i * plane_size; c < (i + 1) * plane_size; c++) {
+                x.data()[c] += alpha * d.data()[c];
+                r.data()[c] -= alpha * q.data()[c];
+                rr += r.data()[c] * r.data()[c];
+            }
+            return std::array<double, 1>{rr};
+        })[0];
+        iteration++;
+        if(residual_norm2 < threshold)
+            break;
+        const double abs_old = abs_new;
+        abs_new = preconditioner.apply(r, z, pool);
+        const double beta = abs_new / abs_old;
+        pool.parallel_for_chunks(0, d.size(), [&](std::size_t begin,
+                                                  std::size_t end) {
+            for(std::size_t c = begin; c < end; c++)
+                d.data()[c] = z.data()[c] + beta * d.data()[c];
+        });
+    }
+    return {iteration, std::sqrt(residual_norm2 / rhs_norm2)};
+}
+
+namespace {
+
+using SparseMatrix = Eigen::SparseMatrix<double, Eigen::RowMajor>;
+
+bool uses_eigen(PressureSolverKind kind) {
+    return kind == PressureSolverKind::EigenCG or
+           kind == PressureSolverKind::EigenIncompleteCholeskyCG;
+}
+
+/*
+Sparsity pattern of A: row c has one entry per neighbour inside the domain,
+plus the diagonal. Entries are sorted by column: lower neighbours from the
+furthest (largest stride) to the closest, the diagonal, then the upper
+neighbours from the closest to the furthest.
+*/
+void build_pattern(SparseMatrix& matrix,
+                   const std::array<std::size_t, 3>& shape) {
+    const std::array<std::size_t, 3> stride = {shape[1] * shape[2], shape[2],
+                                               1};
+    const std::size_t n = shape[0] * shape[1] * shape[2];
+    matrix.resize(n, n);
+    int* outer = matrix.outerIndexPtr();
+    outer[0] = 0;
+    for(std::size_t c = 0; c < n; c++) {
+        const std::array<std::size_t, 3> idxs = {c / stride[0],
+                                                 c / stride[1] % shape[1],
+                                                 c % shape[2]};
+        int nonzeros = 1;
+        for(int dim = 0; dim < 3; dim++) {
+            nonzeros += (idxs[dim] != 0) + (idxs[dim] != shape[dim] - 1);
+        }
+        outer[c + 1] = outer[c] + nonzeros;
+    }
+    matrix.resizeNonZeros(outer[n]);
+    int* inner = matrix.innerIndexPtr();
+    for(std::size_t c = 0; c < n; c++) {
+        const std::array<std::size_t, 3> idxs = {c / stride[0],
+                                                 c / stride[1] % shape[1],
+                                                 c % shape[2]};
+        int e = outer[c];
+        for(int dim = 0; dim < 3; dim++) {
+            if(idxs[dim] != 0)
+                inner[e++] = c - stride[dim];
+        }
+        inner[e++] = c;
+        for(int dim = 2; dim >= 0; dim--) {
+            if(idxs[dim] != shape[dim] - 1)
+                inner[e++] = c + stride[dim];
+        }
+        assert(e == outer[c + 1]);
+    }
+}
+
+// Write the coefficients of row c, in the order of build_pattern
+void assemble_row(SparseMatrix& matrix, const double* vf,
+                  const std::array<std::size_t, 3>& shape,
+                  const std::array<std::size_t, 3>& stride,
+                  const std::array<double, 3>& dx, double light_density,
+                  const std::array<std::size_t, 3>& idxs, std::size_t c) {
+    std::array<double, 3> minus_factor{}, plus_factor{};
+    double total = 0.0;
+    for(int dim = 0; dim < 3; dim++) {
+        if(idxs[dim] != 0) {
+            minus_factor[dim] = inverse_face_density(vf[c], vf[c - stride[dim]],
+                                                     light_density) /
+                                (dx[dim] * dx[dim]);
+            total += minus_factor[dim];
+        }
+        if(idxs[dim] != shape[dim] - 1) {
+            plus_factor[dim] = inverse_face_density(vf[c], vf[c + stride[dim]],
+                                                    light_density) /
+                               (dx[dim] * dx[dim]);
+            total += plus_factor[dim];
+        }
+    }
+    double* value = matrix.valuePtr() + matrix.outerIndexPtr()[c];
+    for(int dim = 0; dim < 3; dim++) {
+        if(idxs[dim] != 0)
+            *value++ = -minus_factor[dim];
+    }
+    *value++ = total;
+    for(int dim = 2; dim >= 0; dim--) {
+        if(idxs[dim] != shape[dim] - 1)
+            *value++ = -plus_factor[dim];
+    }
+    assert(value == matrix.valuePtr() + matrix.outerIndexPtr()[c + 1]);
+}
+
+template<typename Solver>
+PressureSolverStats solve_eigen(Solver& cg, const SparseMatrix& matrix,
+                                bool rebuild_preconditioner,
+                                const GridView<double, 3>& rhs,
+                                GridView<double, 3>& pressure,
+                                const PressureSolverOptions& options) {
+    using namespace Eigen;
+    if(rebuild_preconditioner)
+        cg.factorize(matrix);
+    cg.setTolerance(options.tolerance);
+    if(options.max_iterations != 0)
+        cg.setMaxIterations(options.max_iterations);
+    Map<const VectorXd> b(rhs.data(), rhs.size());
+    Map<VectorXd> x(pressure.data(), pressure.size());
+    x = cg.solveWithGuess(b, x);
+    x.array() -= x.mean();
+    return {static_cast<unsigned int>(cg.iterations()), cg.error()};
+}
+
+}
+
+struct PressureSolver::State {
+    const std::array<std::size_t, 3> shape;
+    Grid<double, 3> rhs;
+    // Volume fraction and cell size the coefficients were computed from
+    Grid<double, 3> assembled_volume_fraction;
+    std::array<double, 3> assembled_dx = {0, 0, 0};
+    bool assembled = false;
+    // Number of solves since the preconditioner was last rebuilt
+    unsigned int preconditioner_age = 0;
+
+    // Eigen solvers
+    SparseMatrix matrix;
+    Eigen::ConjugateGradient<SparseMatrix, Eigen::Lower | Eigen::Upper>
+        jacobi_cg;
+    Eigen::ConjugateGradient<SparseMatrix, Eigen::Lower | Eigen::Upper,
+                             Eigen::IncompleteCholesky<double>>
+        incomplete_cholesky_cg;
+
+    // Grid-based solvers
+    std::unique_ptr<ConjugateGradientWorkspace> workspace;
+    std::unique_ptr<Preconditioner> preconditioner;
+
+    State(std::array<std::size_t, 3> shape, PressureSolverKind kind)
+        : shape(shape), rhs(shape), assembled_volume_fraction(shape) {
+        switch(kind) {
+            case PressureSolverKind::EigenCG:
+                build_pattern(matrix, shape);
+                jacobi_cg.analyzePattern(matrix);
+                break;
+            case PressureSolverKind::EigenIncompleteCholeskyCG:
+                build_pattern(matrix, shape);
+                incomplete_cholesky_cg.analyzePattern(matrix);
+                break;
+            case PressureSolverKind::MatrixFreeCG:
+                workspace = std::make_unique<ConjugateGradientWorkspace>(shape);
+                preconditioner = std::make_unique<JacobiPreconditioner>(shape);
+                break;
+            case PressureSolverKind::Multigrid:
+                preconditioner = std::make_unique<Multigrid>(shape);
+                break;
+            case PressureSolverKind::MultigridCG:
+                workspace = std::make_unique<ConjugateGradientWorkspace>(shape);
+                preconditioner = std::make_unique<Multigrid>(shape);
+                break;
+        }
+    }
+
+    // Refresh the matrix rows whose volume fraction stencil changed since the
+    // previous call (all of them the first time, or if dx changed), and
+    // return how many there were. Without a matrix, only count them.
+    std::size_t refresh(const GridView<double, 3>& volume_fraction,
+                        std::array<double, 3> dx, double light_density,
+                        bool has_matrix, ThreadPool& pool) {
+        const bool all = not assembled or dx != assembled_dx;
+        const std::array<std::size_t, 3> stride = {shape[1] * shape[2],
+                                                   shape[2], 1};
+        const double* vf = volume_fraction.data();
+        const double* old = assembled_volume_fraction.data();
+        const double changed =
+            pool.ordered_sum<1>(shape[0], [&](std::size_t i) {
+                double count = 0;
+                std::size_t c = i * stride[0];
+                for(std::size_t j = 0; j < shape[1]; j++) {
+                    for(std::size_t k = 0; k < shape[2]; k++, c++) {
+                        const std::array<std::size_t, 3> idxs = {i, j, k};
+                        bool dirty = all or vf[c] != old[c];
+                        for(int dim = 0; dim < 3; dim++) {
+                            if(idxs[dim] != 0)
+                                dirty |= vf[c - stride[dim]] !=
+                                         old[c - stride[dim]];
+                            if(idxs[dim] != shape[dim] - 1)
+                                dirty |= vf[c + stride[dim]] !=
+                                         old[c + stride[dim]];
+                        }
+                        if(not dirty)
+                            continue;
+                        count++;
+                        if(has_matrix)
+                            assemble_row(matrix, vf, shape, stride, dx,
+                                         light_density, idxs, c);
+                    }
+                }
+                return std::array<double, 1>{count};
+            })[0];
+        if(changed != 0)
+            assembled_volume_fraction = volume_fraction;
+        assembled = true;
+        assembled_dx = dx;
+        return changed;
+    }
+};
+
+PressureSolver::PressureSolver(PressureSolverOptions options)
+    : _options(options) {
+}
+PressureSolver::PressureSolver(PressureSolver&&) = default;
+PressureSolver::~PressureSolver() = default;
+
+GridView<double, 3>&
+PressureSolver::right_hand_side(std::array<std::size_t, 3> shape) {
+    if(not state or state->shape != shape)
+        state = std::make_unique<State>(shape, _options.kind);
+    return state->rhs;
+}
+
+PressureSolverStats
+PressureSolver::solve(const GridView<double, 3>& volume_fraction,
+                      std::array<double, 3> dx, GridView<double, 3>& pressure,
+                      ThreadPool& pool) {
+    assert(state);
+    State& s = *state;
+    assert(dims_of(volume_fraction) == s.shape);
+    assert(dims_of(pressure) == s.shape);
+
+    // The solvers work with A = -div(1/rho grad), which is positive
+    // semi-definite
+    pool.parallel_for_chunks(0, s.rhs.size(), [&](std::size_t begin,
+                                                   std::size_t end) {
+        for(std::size_t c = begin; c < end; c++)
+            s.rhs.data()[c] = -s.rhs.data()[c];
+    });
+
+    const bool first_solve = not s.assembled;
+    const bool changed =
+        s.refresh(volume_fraction, dx, _options.light_density,
+                  uses_eigen(_options.kind), pool) != 0;
+    const bool rebuild_preconditioner =
+        first_solve or
+        (changed and (s.preconditioner_age >= _options.preconditioner_reuse or
+                      _options.kind == PressureSolverKind::Multigrid));
+    if(rebuild_preconditioner)
+        s.preconditioner_age = 0;
+    s.preconditioner_age++;
+
+    const PoissonOperator A{volume_fraction, dx, _options.light_density};
+    if(s.preconditioner and rebuild_preconditioner)
+        s.preconditioner->update(A, pool);
+
+    PressureSolverStats stats;
+    switch(_options.kind) {
+        case PressureSolverKind::EigenCG:
+            stats = solve_eigen(s.jacobi_cg, s.matrix, rebuild_preconditioner,
+                                s.rhs, pressure, _options);
+            break;
+        case PressureSolverKind::EigenIncompleteCholeskyCG:
+            stats = solve_eigen(s.incomplete_cholesky_cg, s.matrix,
+                                rebuild_preconditioner, s.rhs, pressure,
+                                _options);
+            break;
+        case PressureSolverKind::MatrixFreeCG:
+        case PressureSolverKind::MultigridCG:
+            stats = conjugate_gradient(A, s.rhs, pressure, _options,
+                                       *s.preconditioner, *s.workspace, pool);
+            break;
+        case PressureSolverKind::Multigrid:
+            stats = static_cast<const Multigrid&>(*s.preconditioner)
+                        .solve(s.rhs, pressure, _options, pool);
+            break;
+    }
+    if(not uses_eigen(_options.kind)) {
+        const double mean =
+            std::reduce(pressure.data(), pressure.data() + pressure.size(),
+                        0.0) /
+            pressure.size();
+        pool.parallel_for_chunks(0, pressure.size(), [&](std::size_t begin,
+                                                         std::size_t end) {
+            for(std::size_t c = begin; c < end; c++) pressure.data()[c] -= mean;
+        });
+    }
+
+    _last_stats = stats;
+    if(_options.log) {
+        *_options.log << stats.iterations << ',' << stats.residual << '\n';
+    }
+    return stats;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "grid.hpp"
+#include "thread_pool.hpp"
+#include <array>
+#include <memory>
+#include <ostream>
+
+enum class PressureSolverKind {
+    // Assemble an Eigen::SparseMatrix and solve it with Eigen's
+    // (Jacobi-preconditioned) ConjugateGradient
+    EigenCG,
+    // Same matrix, with Eigen's IncompleteCholesky as the preconditioner
+    EigenIncompleteCholeskyCG,
+    // Jacobi-preconditioned CG on the grids themselves, recomputing the
+    // matrix coefficients from the volume fraction on the fly
+    MatrixFreeCG,
+    // Geometric multigrid V-cycles until convergence
+    Multigrid,
+    // Matrix-free CG preconditioned with one multigrid V-cycle
+    MultigridCG,
+};
+
+struct PressureSolverOptions {
+    PressureSolverKind kind = PressureSolverKind::EigenCG;
+    // Relative residual |b - Ax| / |b| at which the solver stops.
+    // Not Eigen's default (machine epsilon): the system is singular, and CG
+    // stagnates around 1e-15 and then diverges until the iteration limit.
+    double tolerance = 1e-10;
+    // 0 means twice the number of cells for CG (Eigen's default), and
+    // default_multigrid_cycles for standalone multigrid
+    unsigned int max_iterations = 0;
+    static constexpr unsigned int default_multigrid_cycles = 100;
+    // Number of solves a preconditioner is used for before it is rebuilt
+    // from the current coefficients. CG still converges to the right
+    // solution with an outdated preconditioner, only in more iterations:
+    // as the interface moves, many more, hence the default of rebuilding
+    // whenever the coefficients changed. The standalone multigrid is always
+    // rebuilt, as it is the solver.
+    unsigned int preconditioner_reuse = 1;
+    // If set, every solve writes a line "iterations,residual" to it
+    std::ostream* log = nullptr;
+    // Density of the light phase, see rho(). The default makes the heavy
+    // phase 101 times denser.
+    double light_density = 0.01;
+};
+
+struct PressureSolverStats {
+    unsigned int iterations = 0;
+    double residual = 0; // Relative to the norm of the right-hand side
+};
+
+/*
+The variable-density Poisson operator of the projection step, never stored as
+a matrix: for each cell c and each neighbour nb inside the domain,
+    (A p)_c += 2 / (rho(vf_c) + rho(vf_nb)) / dx^2 * (p_c - p_nb)
+i.e. A = -div(1/rho grad) with homogeneous Neumann walls, rho being that of
+light_density. A is symmetric positive semi-definite, and is the negation of
+the Eigen matrix.
+*/
+struct PoissonOperator {
+    const GridView<double, 3>& volume_fraction;
+    std::array<double, 3> dx;
+    double light_density;
+
+    void apply(const GridView<double, 3>& p, GridView<double, 3>& out,
+               ThreadPool& pool) const;
+    void diagonal(GridView<double, 3>& out, ThreadPool& pool) const;
+};
+
+class Preconditioner {
+public:
+    virtual ~Preconditioner() = default;
+    // Set z to an approximation of A^-1 r, and return the dot product r.z
+    virtual double apply(const GridView<double, 3>& r, GridView<double, 3>& z,
+                         ThreadPool& pool) const = 0;
+    // Recompute from the coefficients of A, which must have the shape the
+    // preconditioner was built for. Does not allocate.
+    virtual void update(const PoissonOperator& A, ThreadPool& pool) = 0;
+};
+
+class JacobiPreconditioner: public Preconditioner {
+    Grid<double, 3> inverse_diagonal;
+
+public:
+    explicit JacobiPreconditioner(std::array<std::size_t, 3> shape)
+        : inverse_diagonal(shape) {
+    }
+    JacobiPreconditioner(const PoissonOperator& A, ThreadPool& pool);
+    double apply(const GridView<double, 3>& r, GridView<double, 3>& z,
+                 ThreadPool& pool) const override;
+    void update(const PoissonOperator& A, ThreadPool& pool) override;
+};
+
+struct ConjugateGradientWorkspace {
+    Grid<double, 3> r, z, d, q;
+
+    explicit ConjugateGradientWorkspace(std::array<std::size_t, 3> shape)
+        : r(shape), z(shape), d(shape), q(shape) {
+    }
+};
+
+// Solve A x = b with x containing the initial guess. b, x and the workspace
+// must have the shape of the volume fraction.
+PressureSolverStats conjugate_gradient(const PoissonOperator& A,
+                                       const GridView<double, 3>& b,
+                                       GridView<double, 3>& x,
+                                       const PressureSolverOptions& options,
+                                       const Preconditioner& preconditioner,
+                                       ConjugateGradientWorkspace& workspace,
+                                       ThreadPool& pool);
+
+/*
+Pressure solver that keeps its state from one time step to the next.
+Everything that only depends on the grid shape (the sparsity pattern of the
+Eigen matrix, the right-hand side, the CG workspace, the preconditioner and
+the multigrid hierarchy) is allocated by the first solve, and again only if
+the shape changes. Later solves refresh the matrix rows whose volume fraction
+stencil changed, and rebuild the preconditioner every
+options.preconditioner_reuse solves, so that they do not allocate (Eigen's
+ConjugateGradient still allocates its own vectors).
+*/
+class PressureSolver {
+    struct State;
+
+    PressureSolverOptions _options;
+    std::unique_ptr<State> state;
+    PressureSolverStats _last_stats;
+
+public:
+    explicit PressureSolver(PressureSolverOptions options = {});
+    PressureSolver(PressureSolver&&);
+    ~PressureSolver();
+
+    const PressureSolverOptions& options() const {
+        return _options;
+    }
+    const PressureSolverStats& last_stats() const {
+        return _last_stats;
+    }
+
+    // Grid of the given shape where the caller writes the right-hand side
+    // of the next solve
+    GridView<double, 3>& right_hand_side(std::array<std::size_t, 3> shape);
+    // Solve div(1/rho grad pressure) = right-hand side with homogeneous
+    // Neumann walls. pressure contains the initial guess, and receives the
+    // solution with a zero mean. The right-hand side is overwritten.
+    PressureSolverStats solve(const GridView<double, 3>& volume_fraction,
+                              std::array<double, 3> dx,
+                              GridView<double, 3>& pressure, ThreadPool& pool);
+};
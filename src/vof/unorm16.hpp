@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+/*
+Fixed-point number in [0, 1] on 16 bits: the integer n stands for n / 65535,
+so that 0 and 1 are exact and the tests for empty and full cells keep their
+meaning. A quarter of the size of a double, for storing the volume fraction.
+Reads convert to double and writes round to the nearest step (about 1.5e-5),
+clamping to [0, 1], so that code written for double grids works unchanged.
+*/
+class UNorm16 {
+    std::uint16_t bits = 0;
+
+    static constexpr double one = 65535;
+    static constexpr double step = 1 / one;
+    static_assert(one * step == 1.0);
+
+public:
+    UNorm16() = default;
+    UNorm16(double value)
+        : bits(static_cast<std::uint16_t>(std::clamp(value, 0.0, 1.0) * one +
+                                          0.5)) {
+    }
+    operator double() const {
+        return bits * step;
+    }
+};
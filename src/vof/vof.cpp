@@ -1,19 +1,18 @@
 #include "vof.hpp"
+#include "density.hpp"
 #include "intersect.hpp"
+#include "normals.hpp"
+#include "pressure_solver.hpp"
 #include "cube_utils/permute.hpp"
-#include <Eigen/IterativeLinearSolvers>
-#include <Eigen/SparseCore>
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <limits>
+#include <numeric>
 #include <ostream>
 #include <span>
 #include <tuple>
 
-double rho(double volume_fraction) {
-    return 0.01 + 1 * volume_fraction;
-}
-
 constexpr double g = 9.81;
 
 /*
@@ -28,20 +27,23 @@ cell center.
 grid... unless we use a centered scheme, in which case we can have it on the
 cell center
 */
-template<template<typename> class allocator>
-::Grid<Speed, ndim, allocator<Speed>>
-VOF<allocator>::compute_transport_velocity(const _StaggeredGrid& before,
-                                           _Grid<Speed> forces,
-                                           std::array<double, 3> dx) {
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+typename VOF<allocator, Boundary, scalar,
+             fraction>::template _ScratchVectorGrid<scalar>
+VOF<allocator, Boundary, scalar, fraction>::compute_transport_velocity_two_pass(
+    const _StaggeredGrid& before, const _ScratchVectorGrid<scalar>& forces,
+    std::array<double, 3> dx) const {
     const auto inner_grid_shape = before.volume_fraction.shape();
     const auto inner_grid_indices = before.volume_fraction.indices();
     assert(before.volume_fraction.shape() == forces.shape());
-    ::Grid<double, ndim> uiuj[3] = {
-        {inner_grid_shape},
-        {inner_grid_shape},
-        {inner_grid_shape},
+    _ScratchGrid<scalar> uiuj[3] = {
+        {inner_grid_shape, scratch},
+        {inner_grid_shape, scratch},
+        {inner_grid_shape, scratch},
     };
-    for(const auto& [i, j, k]: inner_grid_indices) {
+    pool.for_each_index(inner_grid_indices, [&](const auto& idxs) {
+        const auto [i, j, k] = idxs;
         double ui = (before.u[0][i][j][k] + before.u[0][i + 1][j][k]) / 2;
         double uj = (before.u[1][i][j][k] + before.u[1][i][j + 1][k]) / 2;
         double uk = (before.u[2][i][j][k] + before.u[2][i][j][k + 1]) / 2;
@@ -49,106 +51,263 @@ VOF<allocator>::compute_transport_velocity(const _StaggeredGrid& before,
         uiuj[0][i][j][k] = ujui + uiuk + ui * ui;
         uiuj[1][i][j][k] = ujui + ujuk + uj * uj;
         uiuj[2][i][j][k] = ujuk + uiuk + uk * uk;
-    }
-    _Grid<Speed> u_trans(inner_grid_shape);
-    for(const auto& idxs: inner_grid_indices) {
+    });
+    _ScratchVectorGrid<scalar> u_trans(inner_grid_shape, scratch);
+    const Stencil<ndim> stencil(inner_grid_shape);
+    pool.parallel_for_chunks(0, inner_grid_shape[0], [&](std::size_t begin,
+                                                         std::size_t end) {
         for(int dim = 0; dim < ndim; dim++) {
-            std::array<std::size_t, 3> plus = idxs, minus = idxs;
-            int nbcells = 0;
-            if(idxs[dim] == 0) {
-                u_trans[idxs][dim] = 0;
-                continue;
-            } else {
-                minus[dim]--;
-                nbcells++;
-            }
-            if(idxs[dim] == inner_grid_indices.shape[dim] - 1) {
-                u_trans[idxs][dim] = 0;
-                continue;
-            } else {
-                plus[dim]++;
-                nbcells++;
-            }
-            nbcells = 2;
-            u_trans[idxs][dim] =
-                -(uiuj[dim][plus] - uiuj[dim][minus]) / (nbcells * dx[dim]) +
-                forces[idxs][dim];
-            assert(not std::isnan(u_trans[idxs][dim]));
+            const scalar* flux = uiuj[dim].data();
+            const scalar* force = forces.component(dim).data();
+            scalar* result = u_trans.component(dim).data();
+            const std::ptrdiff_t stride = stencil.stride(dim);
+            stencil.for_each_interior(begin, end, [&](std::size_t c) {
+                result[c] = -(flux[c + stride] - flux[c - stride]) /
+                                (2 * dx[dim]) +
+                            force[c];
+            });
         }
-    }
+        stencil.for_each_boundary(begin, end, [&](const auto& idxs,
+                                                  std::size_t) {
+            for(int dim = 0; dim < ndim; dim++) {
+                if(Boundary::at_wall(idxs[dim], inner_grid_shape[dim])) {
+                    u_trans[idxs][dim] = 0;
+                    continue;
+                }
+                std::array<std::size_t, 3> plus = idxs, minus = idxs;
+                plus[dim] =
+                    Boundary::neighbour(idxs[dim], 1, inner_grid_shape[dim]);
+                minus[dim] =
+                    Boundary::neighbour(idxs[dim], -1, inner_grid_shape[dim]);
+                u_trans[idxs][dim] =
+                    -(uiuj[dim][plus] - uiuj[dim][minus]) / (2 * dx[dim]) +
+                    forces[idxs][dim];
+                assert(not std::isnan(u_trans[idxs][dim]));
+            }
+        });
+    });
     return u_trans;
 }
 
-template<template<typename> class allocator>
-::Grid<double, ndim, allocator<double>> VOF<allocator>::compute_pressure(
-    const _Grid<double>& volume_fraction, const _Grid<Speed>& u_trans,
-    std::array<double, 3> dx, const GridView<double, ndim> previous_pressure) {
-    _Grid<double> div_u(volume_fraction.shape());
-    for(const auto& idxs: div_u.indices()) {
-        assert(div_u[idxs] == 0);
-        for(int dim = 0; dim < ndim; dim++) {
-            std::array<std::size_t, 3> plus = idxs, minus = idxs;
-            int nbcells = 0;
-            if(idxs[dim] != 0) {
-                minus[dim]--;
-                nbcells++;
-            }
-            if(idxs[dim] != u_trans.shape()[dim] - 1) {
-                plus[dim]++;
-                nbcells++;
+/*
+Same as compute_transport_velocity_two_pass, without materializing u_i u_j:
+each thread computes it plane by plane along the first axis, into a ring of
+three planes, and consumes each plane of u_trans as soon as its neighbour
+planes are there. The planes around the edges of the chunks are computed by
+both threads.
+*/
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+typename VOF<allocator, Boundary, scalar,
+             fraction>::template _ScratchVectorGrid<scalar>
+VOF<allocator, Boundary, scalar, fraction>::compute_transport_velocity(
+    const _StaggeredGrid& before, const _ScratchVectorGrid<scalar>& forces,
+    std::array<double, 3> dx) const {
+    const auto& shape = before.volume_fraction.shape();
+    assert(shape == forces.shape());
+    const std::size_t plane_size = shape[1] * shape[2];
+    _ScratchVectorGrid<scalar> u_trans(shape, scratch);
+    // Per thread, three slots of the ndim components of a plane
+    Grid<scalar, 3, _ScratchAllocator<scalar>> rings(
+        {pool.size(), 3 * ndim, plane_size}, scratch);
+    const Stencil<2> plane_stencil(std::array{shape[1], shape[2]});
+
+    // u_i u_j on the plane i
+    auto fill_plane = [&](std::size_t i, scalar* uiuj) {
+        const scalar* u0 = before.u[0].data() + i * plane_size;
+        for(std::size_t j = 0; j < shape[1]; j++) {
+            const scalar* u1 =
+                before.u[1].data() + (i * (shape[1] + 1) + j) * shape[2];
+            const scalar* u2 =
+                before.u[2].data() + (i * shape[1] + j) * (shape[2] + 1);
+            const std::size_t row = j * shape[2];
+            for(std::size_t k = 0; k < shape[2]; k++) {
+                double ui = (u0[row + k] + u0[plane_size + row + k]) / 2;
+                double uj = (u1[k] + u1[shape[2] + k]) / 2;
+                double uk = (u2[k] + u2[k + 1]) / 2;
+                double ujuk = uj * uk, ujui = uj * ui, uiuk = ui * uk;
+                uiuj[row + k] = ujui + uiuk + ui * ui;
+                uiuj[plane_size + row + k] = ujui + ujuk + uj * uj;
+                uiuj[2 * plane_size + row + k] = ujuk + uiuk + uk * uk;
             }
-            nbcells = 2;
-            div_u[idxs] += (u_trans[plus][dim] - u_trans[minus][dim]) /
-                           (nbcells * dx[dim]);
-            assert(not std::isnan(div_u[idxs]));
         }
-    }
+    };
 
-    using namespace Eigen;
+    pool.parallel_for_chunks(0, shape[0], [&](std::size_t begin,
+                                              std::size_t end,
+                                              unsigned thread_id) {
+        scalar* ring = &rings[{thread_id, 0, 0}];
+        // Plane held by each slot, shape[0] if none
+        std::array<std::size_t, 3> slot_plane;
+        slot_plane.fill(shape[0]);
+        for(std::size_t i = begin; i < end; i++) {
+            const std::array<std::size_t, 3> needed = {
+                Boundary::neighbour(i, -1, shape[0]), i,
+                Boundary::neighbour(i, 1, shape[0])};
+            // u_i u_j on the planes before, at and after i
+            std::array<const scalar*, 3> uiuj;
+            for(int n = 0; n < 3; n++) {
+                auto slot = std::find(slot_plane.begin(), slot_plane.end(),
+                                      needed[n]);
+                const bool cached = slot != slot_plane.end();
+                if(not cached) {
+                    // Evict a plane that is not needed any more
+                    slot = std::find_if(
+                        slot_plane.begin(), slot_plane.end(),
+                        [&](std::size_t plane) {
+                            return std::find(needed.begin(), needed.end(),
+                                             plane) == needed.end();
+                        });
+                    *slot = needed[n];
+                }
+                scalar* plane =
+                    ring + (slot - slot_plane.begin()) * ndim * plane_size;
+                if(not cached)
+                    fill_plane(needed[n], plane);
+                uiuj[n] = plane;
+            }
 
-    SparseMatrix<double> A(div_u.size(), div_u.size());
-    A.reserve(VectorXi::Constant(div_u.size(), ndim * 2 + 1));
-    for(const auto& idxs: div_u.indices()) {
-        double total = 0.0;
-        std::size_t c = div_u.idx_to_offset(idxs);
-        for(int dim = 0; dim < ndim; dim++) {
-            if(idxs[dim] != 0) {
-                std::array<std::size_t, 3> minus = idxs;
-                minus[dim]--;
-                double factor =
-                    2 /
-                    (rho(volume_fraction[idxs]) + rho(volume_fraction[minus])) /
-                    (dx[dim] * dx[dim]);
-                total += factor;
-                A.insert(c, volume_fraction.idx_to_offset(minus)) = factor;
+            const std::size_t offset = i * plane_size;
+            // Across planes
+            const scalar* force = forces.component(0).data() + offset;
+            scalar* result = u_trans.component(0).data() + offset;
+            if(Boundary::at_wall(i, shape[0])) {
+                std::fill(result, result + plane_size, 0.0);
+            } else {
+                for(std::size_t c = 0; c < plane_size; c++) {
+                    result[c] = -(uiuj[2][c] - uiuj[0][c]) / (2 * dx[0]) +
+                                force[c];
+                }
             }
-            if(idxs[dim] != volume_fraction.shape()[dim] - 1) {
-                std::array<std::size_t, 3> plus = idxs;
-                plus[dim]++;
-                double factor =
-                    2 /
-                    (rho(volume_fraction[idxs]) + rho(volume_fraction[plus])) /
-                    (dx[dim] * dx[dim]);
-                total += factor;
-                A.insert(c, volume_fraction.idx_to_offset(plus)) = factor;
+            // Within the plane
+            for(int dim = 1; dim < ndim; dim++) {
+                const scalar* flux = uiuj[1] + dim * plane_size;
+                const scalar* force = forces.component(dim).data() + offset;
+                scalar* result = u_trans.component(dim).data() + offset;
+                const std::ptrdiff_t stride = plane_stencil.stride(dim - 1);
+                plane_stencil.for_each_interior(
+                    0, shape[1], [&](std::size_t c) {
+                        result[c] = -(flux[c + stride] - flux[c - stride]) /
+                                        (2 * dx[dim]) +
+                                    force[c];
+                    });
+                plane_stencil.for_each_boundary(
+                    0, shape[1], [&](const auto& jk, std::size_t c) {
+                        const int axis = dim - 1;
+                        if(Boundary::at_wall(jk[axis], shape[dim])) {
+                            result[c] = 0;
+                            return;
+                        }
+                        std::array<std::size_t, 2> plus = jk, minus = jk;
+                        plus[axis] =
+                            Boundary::neighbour(jk[axis], 1, shape[dim]);
+                        minus[axis] =
+                            Boundary::neighbour(jk[axis], -1, shape[dim]);
+                        result[c] = -(flux[plane_stencil.offset(plus)] -
+                                      flux[plane_stencil.offset(minus)]) /
+                                        (2 * dx[dim]) +
+                                    force[c];
+                        assert(not std::isnan(result[c]));
+                    });
             }
         }
-        A.insert(c, c) = -total;
-    }
+    });
+    return u_trans;
+}
+
+// Copy a grid into one of the same shape and another scalar type
+template<typename From, typename To>
+void convert(const GridView<From, 3>& from, GridView<To, 3>& to,
+             ThreadPool& pool) {
+    assert(from.shape() == to.shape());
+    const From* source = from.data();
+    To* destination = to.data();
+    pool.parallel_for_chunks(0, from.size(), [&](std::size_t begin,
+                                                 std::size_t end) {
+        std::copy(source + begin, source + end, destination + begin);
+    });
+}
 
-    ConjugateGradient<SparseMatrix<double>, Lower | Upper> cg;
-    cg.compute(A);
-    Map<VectorXd> rhs(div_u.data(), div_u.size());
-    Map<const VectorXd> previous_pressure_eig(previous_pressure.data(),
-                                              previous_pressure.size());
-    VectorXd pressure_eig = cg.solveWithGuess(rhs, previous_pressure_eig);
-    pressure_eig.array() -= pressure_eig.mean();
-    for(const auto& element: pressure_eig) assert(not std::isnan(element));
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+void VOF<allocator, Boundary, scalar, fraction>::compute_pressure(
+    const _Grid<fraction>& volume_fraction,
+    const _ScratchVectorGrid<scalar>& u_trans,
+    std::array<double, 3> dx, const GridView<scalar, ndim>& previous_pressure,
+    GridView<scalar, ndim>& pressure) const {
+    GridView<double, ndim>& div_u =
+        pressure_solver.right_hand_side(volume_fraction.shape());
+    const auto& shape = volume_fraction.shape();
+    const Stencil<ndim> stencil(shape);
+    const std::array<std::ptrdiff_t, 3> stride = {
+        stencil.stride(0), stencil.stride(1), stencil.stride(2)};
+    const scalar* u[3] = {u_trans.component(0).data(),
+                          u_trans.component(1).data(),
+                          u_trans.component(2).data()};
+    double* div = div_u.data();
+    pool.parallel_for_chunks(0, shape[0], [&](std::size_t begin,
+                                              std::size_t end) {
+        stencil.for_each_interior(begin, end, [&](std::size_t c) {
+            double result = 0.0;
+            for(int dim = 0; dim < ndim; dim++) {
+                result += (u[dim][c + stride[dim]] - u[dim][c - stride[dim]]) /
+                          (2 * dx[dim]);
+            }
+            div[c] = result;
+        });
+        stencil.for_each_boundary(begin, end, [&](const auto& idxs,
+                                                  std::size_t c) {
+            double result = 0.0;
+            for(int dim = 0; dim < ndim; dim++) {
+                std::array<std::size_t, 3> plus = idxs, minus = idxs;
+                plus[dim] = Boundary::neighbour(idxs[dim], 1, shape[dim]);
+                minus[dim] = Boundary::neighbour(idxs[dim], -1, shape[dim]);
+                result += (u_trans[plus][dim] - u_trans[minus][dim]) /
+                          (2 * dx[dim]);
+                assert(not std::isnan(result));
+            }
+            div[c] = result;
+        });
+    });
 
-    _Grid<double> pressure(div_u.shape());
-    Map<VectorXd> map(pressure.data(), pressure.size());
-    map = std::move(pressure_eig);
-    return pressure;
+    // The solver works in double: the fields stored as another type are
+    // widened for it, and the pressure is narrowed back
+    if constexpr(not std::is_same_v<scalar, double>) {
+        /*
+        With walls all around, the right-hand side must sum to zero. The
+        rounding of the stored velocities leaves a mean in it that is above
+        the tolerance of the solve, and CG diverges once it has removed
+        everything else, so remove the mean first.
+        */
+        const double mean =
+            std::reduce(div, div + div_u.size(), 0.0) / div_u.size();
+        pool.parallel_for_chunks(0, div_u.size(), [&](std::size_t begin,
+                                                      std::size_t end) {
+            for(std::size_t c = begin; c < end; c++) div[c] -= mean;
+        });
+    }
+    auto solve = [&](const GridView<double, ndim>& wide_volume_fraction) {
+        if constexpr(std::is_same_v<scalar, double>) {
+            pressure = previous_pressure;
+            pressure_solver.solve(wide_volume_fraction, dx, pressure, pool);
+        } else {
+            _ScratchGrid<double> wide_pressure(shape, scratch);
+            convert(previous_pressure, wide_pressure, pool);
+            pressure_solver.solve(wide_volume_fraction, dx, wide_pressure,
+                                  pool);
+            convert(wide_pressure, pressure, pool);
+        }
+    };
+    if constexpr(std::is_same_v<fraction, double>) {
+        solve(volume_fraction);
+    } else {
+        _ScratchGrid<double> wide_volume_fraction(shape, scratch);
+        convert(volume_fraction, wide_volume_fraction, pool);
+        solve(wide_volume_fraction);
+    }
+    for(const auto& idxs: pressure.indices()) {
+        assert(not std::isnan(pressure[idxs]));
+    }
 }
 
 template<typename dtype>
@@ -396,177 +555,320 @@ get_wall_sizes(double volume_fraction, std::span<double, 3> normal) {
     return std::make_tuple(wall_sizes_early, wall_sizes_late);
 }
 
-template<template<typename> class allocator>
-void VOF<allocator>::step(const _StaggeredGrid& before, _StaggeredGrid& after,
-                          double _t, double dt) const {
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+Speed VOF<allocator, Boundary, scalar, fraction>::max_speeds(
+    const _StaggeredGrid& grid) const {
+    thread_speeds.assign(pool.size() * ndim, 0);
+    for(int dim = 0; dim < ndim; dim++) {
+        const scalar* u = grid.u[dim].data();
+        pool.parallel_for_chunks(
+            0, grid.u[dim].size(),
+            [&](std::size_t begin, std::size_t end, unsigned thread_id) {
+                double& result = thread_speeds[thread_id * ndim + dim];
+                for(std::size_t c = begin; c < end; c++)
+                    result = std::max<double>(result, std::abs(u[c]));
+            });
+    }
+    Speed speeds{};
+    for(unsigned thread = 0; thread < pool.size(); thread++) {
+        for(int dim = 0; dim < ndim; dim++)
+            speeds[dim] =
+                std::max(speeds[dim], thread_speeds[thread * ndim + dim]);
+    }
+    return speeds;
+}
+
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+double VOF<allocator, Boundary, scalar, fraction>::max_stable_dt(
+    const _StaggeredGrid& grid) const {
+    const auto& shape = grid.volume_fraction.shape();
+    const Speed speeds = max_speeds(grid);
+    double result = std::numeric_limits<double>::infinity();
+    for(int dim = 0; dim < ndim; dim++) {
+        // Largest dt with dt (u + a dt) <= cfl dx, for a face at speed u
+        // accelerated by a, written without cancellation for large u
+        const double u = speeds[dim], a = dim == 2 ? g : 0,
+                     distance = cfl / shape[dim];
+        if(u == 0 and a == 0)
+            continue;
+        const double root = std::sqrt(u * u + 4 * a * distance);
+        result = std::min(result, 2 * distance / (u + root));
+    }
+    return result;
+}
+
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+bool VOF<allocator, Boundary, scalar, fraction>::stable_step(
+    const _StaggeredGrid& after, double dt) const {
+    const auto& shape = after.volume_fraction.shape();
+    const Speed speeds = max_speeds(after);
+    for(int dim = 0; dim < ndim; dim++) {
+        // Steps of max_stable_dt from rest reach the limit up to rounding
+        if(speeds[dim] * dt > cfl / shape[dim] * (1 + 1e-12))
+            return false;
+    }
+    return true;
+}
+
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+void VOF<allocator, Boundary, scalar, fraction>::step(
+    const _StaggeredGrid& before, _StaggeredGrid& after, double _t,
+    double dt) const {
+    // The grids of the previous step are gone: recycle their memory
+    scratch.reset();
     std::array<double, 3> dx;
     for(int dim = 0; dim < 3; dim++)
         dx[dim] = 1.0 / before.volume_fraction.shape()[dim];
-    _Grid<Speed> forces(before.volume_fraction.shape());
+    const auto& shape = before.volume_fraction.shape();
+    _ScratchVectorGrid<scalar> forces(shape, scratch);
     const double cell_volume =
         std::reduce(dx.begin(), dx.end(), 1, std::multiplies<double>{});
-    for(const auto& idx: forces.indices()) {
-        forces[idx][2] = -g;
-    }
+    pool.for_each_index(forces.indices(),
+                        [&](const auto& idx) { forces[idx][2] = -g; });
 
-    auto u_trans = compute_transport_velocity(before, std::move(forces), dx);
-    after.pressure =
-        compute_pressure(before.volume_fraction, u_trans, dx, before.pressure);
+    auto u_trans =
+        fused_transport_velocity
+            ? compute_transport_velocity(before, forces, dx)
+            : compute_transport_velocity_two_pass(before, forces, dx);
+    compute_pressure(before.volume_fraction, u_trans, dx, before.pressure,
+                     after.pressure);
     for(const auto& idxs: after.pressure.indices()) {
         assert(not std::isnan(after.pressure[idxs]));
     }
 
+    const Stencil<ndim> cell_stencil(shape);
     for(int dim = 0; dim < ndim; dim++) {
-        for(const auto& idxs: before.u[dim].indices()) {
-            if(idxs[dim] == 0 or idxs[dim] == before.u[dim].shape()[dim] - 1) {
-                // TODO: how to handle the boundary?
-                after.u[dim][idxs] = 0;
-            } else {
-                std::array<std::size_t, 3> minus = idxs;
-                minus[dim]--;
-                after.u[dim][idxs] =
-                    before.u[dim][idxs] +
-                    dt * (after.pressure[minus] - after.pressure[idxs]) /
-                        dx[dim] /
-                        (rho(before.volume_fraction[minus]) +
-                         rho(before.volume_fraction[idxs])) *
-                        2 +
-                    dt * (u_trans[minus][dim] + u_trans[idxs][dim]) / 2;
+        // Faces along dim; the interior faces have a cell on both sides
+        const Stencil<ndim> face_stencil(before.u[dim].shape());
+        const std::ptrdiff_t stride = cell_stencil.stride(dim);
+        const scalar* u_before = before.u[dim].data();
+        scalar* u_after = after.u[dim].data();
+        const scalar* pressure = after.pressure.data();
+        const fraction* vf = before.volume_fraction.data();
+        const scalar* u_trans_dim = u_trans.component(dim).data();
+        const double light_density =
+            pressure_solver.options().light_density;
+        auto update = [&](const auto& idxs, std::size_t face_begin,
+                          std::size_t count) {
+            const std::size_t cell_begin = cell_stencil.offset(idxs);
+            for(std::size_t n = 0; n < count; n++) {
+                const std::size_t face = face_begin + n,
+                                  cell = cell_begin + n, minus = cell - stride;
+                u_after[face] = u_before[face] +
+                                dt * (pressure[minus] - pressure[cell]) /
+                                    dx[dim] /
+                                    (rho(vf[minus], light_density) +
+                                     rho(vf[cell], light_density)) *
+                                    2 +
+                                dt * (u_trans_dim[minus] + u_trans_dim[cell]) /
+                                    2;
             }
-        }
+        };
+        pool.parallel_for_chunks(
+            0, before.u[dim].shape()[0],
+            [&](std::size_t begin, std::size_t end) {
+                face_stencil.for_each_interior_row(begin, end, update);
+                face_stencil.for_each_boundary(
+                    begin, end, [&](const auto& idxs, std::size_t face) {
+                        if(Boundary::at_wall(idxs[dim],
+                                             before.u[dim].shape()[dim])) {
+                            // TODO: how to handle the boundary?
+                            u_after[face] = 0;
+                        } else {
+                            update(idxs, face, 1);
+                        }
+                    });
+            });
     }
 
-    _Grid<Speed> normals(before.volume_fraction.shape());
-    for(const auto& [i, j, k]: before.volume_fraction.indices()) {
-        const auto cell_vf = before.volume_fraction[i][j][k];
-        if(0 > cell_vf) {
-            // assert(false);
-            before.volume_fraction[i][j][k] = 0;
-        } else if(1 < cell_vf) {
-            // assert(false);
-            before.volume_fraction[i][j][k] = 1.0;
-        } else if(0 == cell_vf or 1 == cell_vf) {
-            continue;
-        }
-        /* Reconstruction of the line segment with Mixed Young Centered */
-        std::array<double, 3> normal = {0, 0, 0};
-        for(int di = -1; di <= 1; di++) {
-            int di_pushed = di;
-            if(i + di < 0 or i + di >= before.volume_fraction.shape()[0])
-                di_pushed = 0;
-            for(int dj = -1; dj <= 1; dj++) {
-                int dj_pushed = dj;
-                if(j + dj < 0 or j + dj >= before.volume_fraction.shape()[1])
-                    dj_pushed = 0;
-                for(int dk = -1; dk <= 1; dk++) {
-                    int dk_pushed = dk;
-                    if(k + dk < 0 or
-                       k + dk >= before.volume_fraction.shape()[2])
-                        dk_pushed = 0;
-                    int diff = (di != 0) + (dj != 0) + (dk != 0);
-                    int coeff = diff == 1   ? 4
-                                : diff == 2 ? 2
-                                : diff == 3 ? 1
-                                            : 0;
-                    if(di == -1 or di == 1)
-                        normal[0] +=
-                            di *
-                            std::clamp(before.volume_fraction[i + di_pushed]
-                                                             [j + dj_pushed]
-                                                             [k + dk_pushed],
-                                       0.0, 1.0) *
-                            coeff;
-                    if(dj == -1 or dj == 1)
-                        normal[1] +=
-                            dj *
-                            std::clamp(before.volume_fraction[i + di_pushed]
-                                                             [j + dj_pushed]
-                                                             [k + dk_pushed],
-                                       0.0, 1.0) *
-                            coeff;
-                    if(dk == -1 or dk == 1)
-                        normal[2] +=
-                            dk *
-                            std::clamp(before.volume_fraction[i + di_pushed]
-                                                             [j + dj_pushed]
-                                                             [k + dk_pushed],
-                                       0.0, 1.0) *
-                            coeff;
-                }
-            }
-        }
-
-        double normal_norm =
-            std::sqrt(std::pow(normal[0], 2) + std::pow(normal[1], 2) +
-                      std::pow(normal[2], 2));
-        if(normal_norm == 0) {
-            normal[0] = 1.0; // Just set a random nonzero vector
-        } else {
-            for(int dim = 0; dim < ndim; dim++) {
-                normal[dim] = -normal[dim] / normal_norm;
-                assert(not std::isnan(normal[dim]));
+    // The geometric reconstruction only runs on the mixed cells. Grids
+    // written by this scheme carry them, and are already clamped.
+    const std::vector<std::size_t>* interface = &before.interface_cells;
+    if(not before.interface_valid) {
+        // Clamp in a separate pass, so that no thread writes a cell that
+        // another thread reads as a neighbour in the normals pass.
+        collect_cells(shape, interface_cells, [&](const auto& idxs,
+                                                  std::size_t) {
+            const auto [i, j, k] = idxs;
+            const auto cell_vf = before.volume_fraction[i][j][k];
+            if(0 > cell_vf) {
+                // assert(false);
+                before.volume_fraction[i][j][k] = 0;
+            } else if(1 < cell_vf) {
+                // assert(false);
+                before.volume_fraction[i][j][k] = 1.0;
             }
-        }
-        normals[i][j][k] = normal;
+            return 0 < cell_vf and cell_vf < 1;
+        });
+        interface = &interface_cells;
     }
 
-    _Grid<std::array<double, ndim>> wall_sizes_early(
-        before.volume_fraction.shape()),
-        wall_sizes_late(before.volume_fraction.shape());
-    for(const auto& idxs: before.volume_fraction.indices()) {
-        const auto& [wall_sizes_early_i, wall_sizes_late_i] =
-            get_wall_sizes(before.volume_fraction[idxs], normals[idxs]);
-        wall_sizes_early[idxs] = wall_sizes_early_i;
-        wall_sizes_late[idxs] = wall_sizes_late_i;
+    /*
+    The sweeps below skip the blocks where nothing can flow: those whose
+    faces are all still, and the empty ones whose neighbours along the sweep
+    are empty too (their wall sizes are 0). The summary of the new state gets
+    its speeds now, and its volume fractions after the sweeps.
+    */
+    const BlockSummary* before_blocks = &before.blocks;
+    if(not before.blocks_valid) {
+        blocks.resize(shape);
+        pool.parallel_for_chunks(0, blocks.nb_blocks(), [&](std::size_t begin,
+                                                            std::size_t end) {
+            for(std::size_t b = begin; b < end; b++)
+                blocks.update_fraction(before.volume_fraction, b);
+        });
+        before_blocks = &blocks;
     }
+    after.blocks.resize(shape);
+    const std::size_t nblocks = after.blocks.nb_blocks();
+    pool.parallel_for_chunks(0, nblocks, [&](std::size_t begin,
+                                             std::size_t end) {
+        for(std::size_t b = begin; b < end; b++)
+            after.blocks.update_speed(after.u, b);
+    });
+    _block_stats = {};
+    auto find_skipped_blocks = [&](int dim) {
+        skipped_blocks.assign(nblocks, false);
+        _block_stats.blocks += nblocks;
+        if(not skip_uniform_blocks)
+            return;
+        const auto& nb = after.blocks.nblocks();
+        auto empty = [&](std::size_t b) {
+            return before_blocks->max_fraction(b) == 0;
+        };
+        for(std::size_t b = 0; b < nblocks; b++) {
+            const auto block = after.blocks.block(b);
+            std::array<std::size_t, 3> lower = block, upper = block;
+            lower[dim] = block[dim] == 0 ? 0 : block[dim] - 1;
+            upper[dim] = std::min(block[dim] + 1, nb[dim] - 1);
+            skipped_blocks[b] = after.blocks.max_speed(b) == 0 or
+                                (empty(after.blocks.index(lower)) and
+                                 empty(b) and
+                                 empty(after.blocks.index(upper)));
+            _block_stats.skipped += skipped_blocks[b];
+        }
+    };
 
-    _Grid<std::array<double, ndim>> advected_volume_early(
-        before.volume_fraction.shape()),
-        advected_volume_late(before.volume_fraction.shape());
-    for(const auto& idxs: before.volume_fraction.indices()) {
-        for(int dim = 0; dim < ndim; dim++) {
-            auto idxs_after = idxs;
-            idxs_after[dim] += 1;
-            /* Divergence from the Python code: we're not going to evaluate the
-            1st derivative of the wall size (dsize_x, dsize_y), because that
-            sounds too hard */
-            advected_volume_early[idxs][dim] =
-                after.u[dim][idxs] *
-                std::clamp(wall_sizes_early[idxs][dim], 0.0, 1.0);
-            advected_volume_late[idxs][dim] =
-                after.u[dim][idxs_after] *
-                std::clamp(wall_sizes_late[idxs][dim], 0.0, 1.0);
+    // Full and empty cells have wall sizes of 1 and 0 whatever their normal,
+    // and are not written here (see wall_size below).
+    _ScratchVectorGrid<scalar> wall_sizes_early(shape, scratch),
+        wall_sizes_late(shape, scratch);
+    auto reconstruct_normal = [&](const std::array<std::size_t, 3>& idxs) {
+        assert(0 < before.volume_fraction[idxs] and
+               before.volume_fraction[idxs] < 1);
+        if(cell_stencil.is_interior(idxs)) {
+            const fraction* vf = before.volume_fraction.data() +
+                                 cell_stencil.offset(idxs);
+            const std::ptrdiff_t si = cell_stencil.stride(0),
+                                 sj = cell_stencil.stride(1),
+                                 sk = cell_stencil.stride(2);
+            return mixed_young_centered([&](int di, int dj, int dk) {
+                return vf[di * si + dj * sj + dk * sk];
+            });
         }
-    }
+        return mixed_young_centered([&](int di, int dj, int dk) {
+            return before.volume_fraction[{
+                Boundary::neighbour(idxs[0], di, shape[0]),
+                Boundary::neighbour(idxs[1], dj, shape[1]),
+                Boundary::neighbour(idxs[2], dk, shape[2])}];
+        });
+    };
+    // The band is gathered into structure-of-arrays rows (volume fraction,
+    // normal, early and late wall sizes) for the batched get_wall_sizes
+    const std::size_t nband = interface->size();
+    Grid<double, 2, _ScratchAllocator<double>> band({10, nband}, scratch);
+    auto row = [&](int r) {
+        return band.data() + r * nband;
+    };
+    auto rows = [&](int first, std::size_t begin, std::size_t end) {
+        return std::array<std::span<double>, 3>{
+            std::span(row(first) + begin, end - begin),
+            std::span(row(first + 1) + begin, end - begin),
+            std::span(row(first + 2) + begin, end - begin)};
+    };
+    auto band_cell = [&](std::size_t n) -> std::array<std::size_t, 3> {
+        const std::size_t offset = (*interface)[n];
+        return {offset / (shape[1] * shape[2]), offset / shape[2] % shape[1],
+                offset % shape[2]};
+    };
+    // Normals, tile by tile. The band cells of a slab of tiles along the
+    // first axis are contiguous in the band; they are sorted by tile, and the
+    // tiles with enough of them share their partial sums.
+    constexpr std::size_t tile = MixedYoungCenteredTile<Boundary>::size;
+    const std::array<std::size_t, 3> ntiles = {
+        (shape[0] + tile - 1) / tile, (shape[1] + tile - 1) / tile,
+        (shape[2] + tile - 1) / tile};
+    if(normals_workspaces.size() < pool.size())
+        normals_workspaces.resize(pool.size());
+    pool.parallel_for_chunks(0, ntiles[0], [&](std::size_t slab_begin,
+                                               std::size_t slab_end,
+                                               unsigned thread_id) {
+        auto& workspace = normals_workspaces[thread_id];
+        auto& tile_begin = workspace.tile_begin;
+        auto& tile_cells = workspace.tile_cells;
+        auto slab_start = [&](std::size_t slab) {
+            return std::lower_bound(interface->begin(), interface->end(),
+                                    slab * tile * shape[1] * shape[2]) -
+                   interface->begin();
+        };
+        for(std::size_t slab = slab_begin; slab < slab_end; slab++) {
+            const std::size_t first = slab_start(slab),
+                              last = slab_start(slab + 1);
+            auto tile_of = [&](std::size_t n) {
+                const auto idxs = band_cell(n);
+                return idxs[1] / tile * ntiles[2] + idxs[2] / tile;
+            };
+            // Counting sort of the band cells of the slab by tile
+            tile_begin.assign(ntiles[1] * ntiles[2] + 1, 0);
+            for(std::size_t n = first; n < last; n++)
+                tile_begin[tile_of(n) + 1]++;
+            std::partial_sum(tile_begin.begin(), tile_begin.end(),
+                             tile_begin.begin());
+            tile_cells.resize(last - first);
+            auto& tile_fill = workspace.tile_fill;
+            tile_fill.assign(tile_begin.begin(), tile_begin.end() - 1);
+            for(std::size_t n = first; n < last; n++)
+                tile_cells[tile_fill[tile_of(n)]++] = n;
 
-    _StaggeredGrid advected_volume(before.volume_fraction.shape());
-    for(int dim = 0; dim < ndim; dim++) {
-        for(const auto& idxs: before.u[dim].indices()) {
-            // [ i-1 ]  -|-> u_i [ i ]
-            //  late[i-1]|early[i]
-            auto minus = idxs;
-            minus[dim] -= 1;
-            if(idxs[dim] == 0) {
-                advected_volume.u[dim][idxs] = advected_volume_early[idxs][dim];
-            } else if(idxs[dim] == before.u[dim].shape()[dim] - 1) {
-                advected_volume.u[dim][idxs] = advected_volume_late[minus][dim];
-            } else {
-                if(after.u[dim][idxs] > 0) {
-                    double max_pos =
-                        before.volume_fraction[minus] / (dt / dx[dim]);
-                    advected_volume.u[dim][idxs] =
-                        std::min(advected_volume_late[minus][dim], max_pos);
-                } else {
-                    double max_neg =
-                        -before.volume_fraction[idxs] / (dt / dx[dim]);
-                    assert(advected_volume_early[idxs][dim] <= 0);
-                    advected_volume.u[dim][idxs] =
-                        std::max(advected_volume_early[idxs][dim], max_neg);
+            for(std::size_t t = 0; t + 1 < tile_begin.size(); t++) {
+                const bool dense =
+                    tile_begin[t + 1] - tile_begin[t] >= dense_tile_cells;
+                if(dense) {
+                    workspace.tile.load(before.volume_fraction,
+                                        {slab * tile, t / ntiles[2] * tile,
+                                         t % ntiles[2] * tile});
+                }
+                for(std::size_t c = tile_begin[t]; c < tile_begin[t + 1];
+                    c++) {
+                    const std::size_t n = tile_cells[c];
+                    const auto idxs = band_cell(n);
+                    const auto normal = dense ? workspace.tile.normal(idxs)
+                                              : reconstruct_normal(idxs);
+                    row(0)[n] = before.volume_fraction[idxs];
+                    for(int dim = 0; dim < ndim; dim++)
+                        row(1 + dim)[n] = normal[dim];
                 }
             }
         }
-    }
-
+    });
+    pool.parallel_for_chunks(0, nband, [&](std::size_t begin,
+                                           std::size_t end) {
+        const auto normal = rows(1, begin, end);
+        get_wall_sizes(std::span(row(0) + begin, end - begin),
+                       {normal[0], normal[1], normal[2]}, rows(4, begin, end),
+                       rows(7, begin, end));
+        for(std::size_t n = begin; n < end; n++) {
+            const auto idxs = band_cell(n);
+            for(int dim = 0; dim < ndim; dim++) {
+                wall_sizes_early[idxs][dim] = row(4 + dim)[n];
+                wall_sizes_late[idxs][dim] = row(7 + dim)[n];
+            }
+        }
+    });
     // Idea of the dt / dx:
     // u * wall_size is how much volume would pass through a unit wall in one
     // unit of time.
@@ -578,30 +880,154 @@ void VOF<allocator>::step(const _StaggeredGrid& before, _StaggeredGrid& after,
     // -> dt * u * wall_size * dx * dy * dz means that the cell is filled. So
     // the "fill percentage" that passes through is dt * u * wall_size / dz.
 
-    // Split scheme
+    // Split scheme. Each sweep computes the advected volumes of the faces of
+    // a cell where it needs them, so that they never go through memory.
     after.volume_fraction = before.volume_fraction;
-    for(int dim = 0; dim < ndim; dim++) {
-        for(const auto& idxs: before.volume_fraction.indices()) {
-            auto idxs_after = idxs;
-            idxs_after[dim] += 1;
-            after.volume_fraction[idxs] +=
-                (advected_volume.u[dim][idxs] -
-                 advected_volume.u[dim][idxs_after]) *
-                (dt / dx[dim]);
-            if(before.volume_fraction[idxs] >= 0.5) {
-                after.volume_fraction[idxs] +=
-                    (dt / dx[dim]) *
-                    (after.u[dim][idxs] - after.u[dim][idxs_after]);
+    const fraction* vf_before = before.volume_fraction.data();
+    fraction* vf_after = after.volume_fraction.data();
+    const std::array<Stencil<ndim>, ndim> face_stencils = {
+        Stencil<ndim>(before.u[0].shape()), Stencil<ndim>(before.u[1].shape()),
+        Stencil<ndim>(before.u[2].shape())};
+    auto sweep = [&](const std::array<std::size_t, 3>& idxs, std::size_t cell,
+                     int dim) {
+        const double ratio = dt / dx[dim];
+        const scalar* u = after.u[dim].data();
+        const scalar* sizes_early = wall_sizes_early.component(dim).data();
+        const scalar* sizes_late = wall_sizes_late.component(dim).data();
+        const std::ptrdiff_t cell_stride = cell_stencil.stride(dim);
+        // Full and empty cells were not reconstructed
+        auto wall_size = [&](const scalar* wall_sizes, std::size_t c) {
+            const double cell_vf = vf_before[c];
+            return cell_vf >= 1.0 ? 1.0 : cell_vf <= 0 ? 0.0 : wall_sizes[c];
+        };
+        /* Volume advected through a face, from the wall sizes of the cells on
+        both sides (plus - cell_stride and plus) and limited by the volume of
+        the upwind cell.
+        Divergence from the Python code: we're not going to evaluate the 1st
+        derivative of the wall size (dsize_x, dsize_y), because that sounds too
+        hard */
+        //  [ i-1 ]  -|-> u_i [ i ]
+        //   late[i-1]|early[i]
+        auto advected_volume = [&](std::size_t face, std::size_t plus,
+                                   bool first, bool last) {
+            const std::size_t minus = plus - cell_stride;
+            const double u_face = u[face];
+            auto early = [&]() {
+                return u_face *
+                       std::clamp(wall_size(sizes_early, plus), 0.0, 1.0);
+            };
+            auto late = [&]() {
+                return u_face *
+                       std::clamp(wall_size(sizes_late, minus), 0.0, 1.0);
+            };
+            if(first) {
+                return early();
+            } else if(last) {
+                return late();
+            } else if(u_face > 0) {
+                double max_pos = vf_before[minus] / ratio;
+                return std::min(late(), max_pos);
+            } else {
+                double max_neg = -vf_before[plus] / ratio;
+                assert(early() <= 0);
+                return std::max(early(), max_neg);
             }
-            assert(not std::isnan(after.volume_fraction[idxs]));
-            after.volume_fraction[idxs] =
-                std::clamp(after.volume_fraction[idxs], 0.0, 1.0);
+        };
+
+        const Stencil<ndim>& faces = face_stencils[dim];
+        const std::size_t face_before = faces.offset(idxs),
+                          face_after = face_before + faces.stride(dim);
+        // Accumulated in double whatever the storage
+        double cell_vf = vf_after[cell];
+        cell_vf +=
+            (advected_volume(face_before, cell, idxs[dim] == 0, false) -
+             advected_volume(face_after, cell + cell_stride, false,
+                             idxs[dim] == shape[dim] - 1)) *
+            ratio;
+        if(vf_before[cell] >= 0.5) {
+            cell_vf += ratio * (u[face_before] - u[face_after]);
         }
+        assert(not std::isnan(cell_vf));
+        vf_after[cell] = std::clamp(cell_vf, 0.0, 1.0);
+    };
+    for(int dim = 0; dim < ndim - 1; dim++) {
+        find_skipped_blocks(dim);
+        pool.parallel_for_chunks(0, nblocks, [&](std::size_t begin,
+                                                 std::size_t end) {
+            for(std::size_t b = begin; b < end; b++) {
+                if(skipped_blocks[b])
+                    continue;
+                const auto first = after.blocks.begin(b),
+                           last = after.blocks.end(b);
+                for(std::size_t i = first[0]; i < last[0]; i++) {
+                    for(std::size_t j = first[1]; j < last[1]; j++) {
+                        std::size_t cell =
+                            cell_stencil.offset({i, j, first[2]});
+                        for(std::size_t k = first[2]; k < last[2];
+                            k++, cell++)
+                            sweep({i, j, k}, cell, dim);
+                    }
+                }
+            }
+        });
+    }
+    // The last sweep also finds the interface of the new state, so it goes
+    // through the cells in order
+    find_skipped_blocks(ndim - 1);
+    collect_cells(shape, after.interface_cells,
+                  [&](const auto& idxs, std::size_t cell) {
+                      if(not skipped_blocks[after.blocks.block_of(idxs)])
+                          sweep(idxs, cell, ndim - 1);
+                      const double cell_vf = vf_after[cell];
+                      return 0 < cell_vf and cell_vf < 1;
+                  });
+    after.interface_valid = true;
+    pool.parallel_for_chunks(0, nblocks, [&](std::size_t begin,
+                                             std::size_t end) {
+        for(std::size_t b = begin; b < end; b++)
+            after.blocks.update_fraction(after.volume_fraction, b);
+    });
+    after.blocks_valid = true;
+}
+
+template<template<typename> class allocator, typename Boundary,
+         typename scalar, typename fraction>
+template<typename F>
+void VOF<allocator, Boundary, scalar, fraction>::collect_cells(
+    const std::array<std::size_t, 3>& shape, std::vector<std::size_t>& result,
+    F&& f) const {
+    // Each thread collects a contiguous range of cells; the parts are then
+    // concatenated in order.
+    interface_parts.resize(pool.size());
+    pool.parallel_for_chunks(
+        0, shape[0],
+        [&](std::size_t begin, std::size_t end, unsigned thread_id) {
+            std::vector<std::size_t>& part = interface_parts[thread_id];
+            part.clear();
+            std::size_t offset = begin * shape[1] * shape[2];
+            for(std::size_t i = begin; i < end; i++) {
+                for(std::size_t j = 0; j < shape[1]; j++) {
+                    for(std::size_t k = 0; k < shape[2]; k++, offset++) {
+                        if(f(std::array<std::size_t, 3>{i, j, k}, offset))
+                            part.push_back(offset);
+                    }
+                }
+            }
+        });
+    result.clear();
+    for(const auto& part: interface_parts) {
+        result.insert(result.end(), part.begin(), part.end());
     }
 }
 
 #ifdef NO_CUDA
 template class VOF<std::allocator>;
+template class VOF<std::allocator, WallBoundary, float>;
+template class VOF<std::allocator, WallBoundary, double, UNorm16>;
+template class VOF<std::allocator, WallBoundary, float, UNorm16>;
 #else
 template class VOF<>;
+template class VOF<CUDAAllocator, WallBoundary, float>;
+template class VOF<CUDAAllocator, WallBoundary, double, UNorm16>;
+template class VOF<CUDAAllocator, WallBoundary, float, UNorm16>;
 #endif
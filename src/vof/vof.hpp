@@ -1,20 +1,51 @@
+#pragma once
+
+#include "arena.hpp"
+#include "block_summary.hpp"
+#include "boundary.hpp"
 #include "grid.hpp"
+#include "normals.hpp"
+#include "pressure_solver.hpp"
 #include "scheme.hpp"
+#include "thread_pool.hpp"
+#include "unorm16.hpp"
 #include <array>
+#include <memory>
+#include <vector>
 
 constexpr int ndim = 3;
 using Speed = std::array<double, ndim>;
 
-template<typename allocator = CUDAAllocator<double>>
+// The fields are stored as the value type of the allocator (double or float),
+// and the volume fraction as fraction (the same type, or UNorm16)
+template<typename allocator = CUDAAllocator<double>,
+         typename fraction = typename allocator::value_type>
 struct StaggeredGrid {
-    Grid<double, ndim, allocator> volume_fraction;
-    Grid<double, ndim, allocator> u[3];
-    Grid<double, ndim, allocator> pressure;
+    using scalar = typename allocator::value_type;
+    using fraction_allocator = typename std::allocator_traits<
+        allocator>::template rebind_alloc<fraction>;
+    Grid<fraction, ndim, fraction_allocator> volume_fraction;
+    Grid<scalar, ndim, allocator> u[3];
+    Grid<scalar, ndim, allocator> pressure;
+    // Offsets of the mixed cells (0 < volume fraction < 1), in increasing
+    // order. Only meaningful if interface_valid: schemes set it when they
+    // write the grid, and code that writes volume_fraction otherwise must
+    // clear it.
+    std::vector<std::size_t> interface_cells;
+    bool interface_valid = false;
+    // Ranges of the volume fraction and largest speeds by block. Same
+    // contract as the interface, with blocks_valid, for code that writes the
+    // volume fraction or the velocity.
+    BlockSummary blocks;
+    bool blocks_valid = false;
 
-    StaggeredGrid(std::array<std::size_t, ndim> dims)
-        : volume_fraction(dims),
-          u{stagger(dims, 0), stagger(dims, 1), stagger(dims, 2)},
-          pressure(dims) {};
+    StaggeredGrid(std::array<std::size_t, ndim> dims,
+                  const allocator& alloc = allocator())
+        : volume_fraction(dims, fraction_allocator(alloc)),
+          u{{stagger(dims, 0), alloc},
+            {stagger(dims, 1), alloc},
+            {stagger(dims, 2), alloc}},
+          pressure(dims, alloc) {};
 
 private:
     static std::array<std::size_t, ndim>
@@ -26,21 +57,120 @@ private:
     }
 };
 
-template<template<typename> class allocator = CUDAAllocator>
-class VOF: public Scheme<StaggeredGrid<allocator<double>>, 3> {
+// Blocks of the split sweeps of a step, counted once per sweep: skipped are
+// those where nothing can flow, see VOF::step
+struct BlockSkipStats {
+    std::size_t blocks = 0, skipped = 0;
+};
+
+/*
+scalar is the type the fields are stored as, in the grids and in the scratch
+grids of a step, and fraction the type of the volume fraction (UNorm16 stores
+it on 16 bits). Computations on them are done in double, and so is the
+pressure solve.
+*/
+template<template<typename> class allocator = CUDAAllocator,
+         typename Boundary = WallBoundary, typename scalar = double,
+         typename fraction = scalar>
+class VOF: public Scheme<StaggeredGrid<allocator<scalar>, fraction>, 3> {
 private:
     template<typename dtype>
     using _Grid = Grid<dtype, 3, allocator<dtype>>;
-    using _StaggeredGrid = StaggeredGrid<allocator<double>>;
-    static _Grid<double>
-    compute_pressure(const _Grid<double>& volume_fraction,
-                     const _Grid<Speed>& u_trans, std::array<double, 3> dx,
-                     const GridView<double, ndim> previous_pressure);
-    static _Grid<Speed> compute_transport_velocity(const _StaggeredGrid& u,
-                                                   _Grid<Speed> forces,
-                                                   std::array<double, 3> dx);
+    using _StaggeredGrid = StaggeredGrid<allocator<scalar>, fraction>;
+    // Grids that only live during one step come from the scratch arena,
+    // which is recycled every step
+    template<typename dtype>
+    using _ScratchAllocator = ArenaAllocator<dtype, allocator<std::byte>>;
+    template<typename dtype>
+    using _ScratchGrid = Grid<dtype, 3, _ScratchAllocator<dtype>>;
+    // Vector fields are stored one component per plane
+    template<typename dtype>
+    using _ScratchVectorGrid =
+        VectorGrid<dtype, ndim, 3, _ScratchAllocator<dtype>>;
+    // step() is const, but the workers are a resource, not scheme state
+    mutable ThreadPool pool;
+    mutable Arena<allocator<std::byte>> scratch;
+    // Interface of grids that don't carry a valid one
+    mutable std::vector<std::size_t> interface_cells;
+    // Block summary of grids that don't carry a valid one, and the blocks
+    // the current sweep skips
+    mutable BlockSummary blocks;
+    mutable std::vector<unsigned char> skipped_blocks;
+    bool skip_uniform_blocks;
+    mutable BlockSkipStats _block_stats;
+    // Per-thread parts of the interface during collect_cells
+    mutable std::vector<std::vector<std::size_t>> interface_parts;
+    // Offsets of the cells for which f(idxs, offset) is true
+    template<typename F>
+    void collect_cells(const std::array<std::size_t, 3>& shape,
+                       std::vector<std::size_t>& result, F&& f) const;
+    // Per-thread buffers of the normals pass, which sorts the band by tile
+    struct NormalsWorkspace {
+        MixedYoungCenteredTile<Boundary> tile;
+        std::vector<std::size_t> tile_begin, tile_fill, tile_cells;
+    };
+    mutable std::vector<NormalsWorkspace> normals_workspaces;
+    // Band cells from which loading the whole tile is cheaper than the cells
+    // one by one (measured with bench-normals and the per-cell path)
+    static constexpr std::size_t dense_tile_cells = 128;
+    // Keeps the matrix, workspaces and preconditioner between steps
+    mutable PressureSolver pressure_solver;
+    // Per-thread maxima of max_speeds, by thread and axis
+    mutable std::vector<double> thread_speeds;
+    // Largest |u| on the faces along each axis
+    Speed max_speeds(const _StaggeredGrid& grid) const;
+    void compute_pressure(const _Grid<fraction>& volume_fraction,
+                          const _ScratchVectorGrid<scalar>& u_trans,
+                          std::array<double, 3> dx,
+                          const GridView<scalar, ndim>& previous_pressure,
+                          GridView<scalar, ndim>& pressure) const;
+    bool fused_transport_velocity;
+    _ScratchVectorGrid<scalar>
+    compute_transport_velocity(const _StaggeredGrid& u,
+                               const _ScratchVectorGrid<scalar>& forces,
+                               std::array<double, 3> dx) const;
+    // Reference version, with a full grid for each u_i u_j
+    _ScratchVectorGrid<scalar> compute_transport_velocity_two_pass(
+        const _StaggeredGrid& u, const _ScratchVectorGrid<scalar>& forces,
+        std::array<double, 3> dx) const;
 
 public:
+    VOF(unsigned nthreads = 1, PressureSolverOptions pressure_solver = {},
+        bool fused_transport_velocity = true, bool skip_uniform_blocks = true)
+        : pool(nthreads), skip_uniform_blocks(skip_uniform_blocks),
+          pressure_solver(pressure_solver),
+          fused_transport_velocity(fused_transport_velocity) {
+    }
+    unsigned nthreads() const {
+        return pool.size();
+    }
+    // Blocks skipped by the last step
+    const BlockSkipStats& block_stats() const {
+        return _block_stats;
+    }
+    const PressureSolverOptions& pressure_solver_options() const {
+        return pressure_solver.options();
+    }
+    // Convergence of the pressure solve of the last step
+    const PressureSolverStats& pressure_solver_stats() const {
+        return pressure_solver.last_stats();
+    }
     void step(const _StaggeredGrid& before, _StaggeredGrid& after, double t,
               double dt) const override;
+    /*
+    Courant number of max_stable_dt. The sweeps limit the volume advected
+    through a face to the volume of the upwind cell, and a cell can lose
+    volume through both of its faces along the sweep.
+    */
+    static constexpr double cfl = 0.5;
+    /*
+    Largest time step for which the faces along every axis move at most cfl
+    of a cell along it, if gravity accelerates them throughout the step. The
+    pressure can accelerate them further, which stable_step checks once the
+    velocity of the step is known.
+    */
+    double max_stable_dt(const _StaggeredGrid& grid) const override;
+    // Whether the sweeps of the step of dt that gave after, which advect
+    // with its velocity, kept to cfl along every axis
+    bool stable_step(const _StaggeredGrid& after, double dt) const override;
 };
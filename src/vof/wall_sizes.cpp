@@ -0,0 +1,298 @@
+#include "intersect.hpp"
+#include <cassert>
+#include <cmath>
+#if defined(__AVX512F__) or defined(__AVX__) or defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/*
+Batched version of get_wall_sizes (see vof.cpp).
+The kernel is written once, on "lanes" that process one cell (ScalarLanes) or
+a vector register of cells. Every branch of the scalar code is evaluated, and
+the result picked with masked selects. Each candidate uses the same
+operations in the same order as the scalar code, so results are bit-identical
+as long as the compiler does not contract them into FMAs (see NATIVE_ARCH).
+*/
+
+namespace {
+
+struct ScalarLanes {
+    using V = double;
+    using M = bool;
+    static constexpr std::size_t width = 1;
+    static V load(const double* p) {
+        return *p;
+    }
+    static void store(double* p, V v) {
+        *p = v;
+    }
+    static V set(double x) {
+        return x;
+    }
+    static V abs(V v) {
+        return std::abs(v);
+    }
+    static M lt(V a, V b) {
+        return a < b;
+    }
+    static M le(V a, V b) {
+        return a <= b;
+    }
+    static M gt(V a, V b) {
+        return a > b;
+    }
+    static M ge(V a, V b) {
+        return a >= b;
+    }
+    static V select(M m, V if_true, V if_false) {
+        return m ? if_true : if_false;
+    }
+};
+
+#ifdef __SSE2__
+// Baseline of x86-64, so that portable builds are vectorized too
+struct Sse2Lanes {
+    using V = __m128d;
+    using M = __m128d;
+    static constexpr std::size_t width = 2;
+    static V load(const double* p) {
+        return _mm_loadu_pd(p);
+    }
+    static void store(double* p, V v) {
+        _mm_storeu_pd(p, v);
+    }
+    static V set(double x) {
+        return _mm_set1_pd(x);
+    }
+    static V abs(V v) {
+        return _mm_andnot_pd(_mm_set1_pd(-0.0), v);
+    }
+    static M lt(V a, V b) {
+        return _mm_cmplt_pd(a, b);
+    }
+    static M le(V a, V b) {
+        return _mm_cmple_pd(a, b);
+    }
+    static M gt(V a, V b) {
+        return _mm_cmpgt_pd(a, b);
+    }
+    static M ge(V a, V b) {
+        return _mm_cmpge_pd(a, b);
+    }
+    static V select(M m, V if_true, V if_false) {
+        // No blend instruction before SSE4.1
+        return _mm_or_pd(_mm_and_pd(m, if_true), _mm_andnot_pd(m, if_false));
+    }
+};
+#endif
+
+#ifdef __AVX__
+struct AvxLanes {
+    using V = __m256d;
+    using M = __m256d;
+    static constexpr std::size_t width = 4;
+    static V load(const double* p) {
+        return _mm256_loadu_pd(p);
+    }
+    static void store(double* p, V v) {
+        _mm256_storeu_pd(p, v);
+    }
+    static V set(double x) {
+        return _mm256_set1_pd(x);
+    }
+    static V abs(V v) {
+        return _mm256_andnot_pd(_mm256_set1_pd(-0.0), v);
+    }
+    static M lt(V a, V b) {
+        return _mm256_cmp_pd(a, b, _CMP_LT_OQ);
+    }
+    static M le(V a, V b) {
+        return _mm256_cmp_pd(a, b, _CMP_LE_OQ);
+    }
+    static M gt(V a, V b) {
+        return _mm256_cmp_pd(a, b, _CMP_GT_OQ);
+    }
+    static M ge(V a, V b) {
+        return _mm256_cmp_pd(a, b, _CMP_GE_OQ);
+    }
+    static V select(M m, V if_true, V if_false) {
+        return _mm256_blendv_pd(if_false, if_true, m);
+    }
+};
+#endif
+
+#ifdef __AVX512F__
+struct Avx512Lanes {
+    using V = __m512d;
+    using M = __mmask8;
+    static constexpr std::size_t width = 8;
+    static V load(const double* p) {
+        return _mm512_loadu_pd(p);
+    }
+    static void store(double* p, V v) {
+        _mm512_storeu_pd(p, v);
+    }
+    static V set(double x) {
+        return _mm512_set1_pd(x);
+    }
+    static V abs(V v) {
+        return _mm512_abs_pd(v);
+    }
+    static M lt(V a, V b) {
+        return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);
+    }
+    static M le(V a, V b) {
+        return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ);
+    }
+    static M gt(V a, V b) {
+        return _mm512_cmp_pd_mask(a, b, _CMP_GT_OQ);
+    }
+    static M ge(V a, V b) {
+        return _mm512_cmp_pd_mask(a, b, _CMP_GE_OQ);
+    }
+    static V select(M m, V if_true, V if_false) {
+        return _mm512_mask_blend_pd(m, if_false, if_true);
+    }
+};
+#endif
+
+template<typename L>
+void wall_sizes_lanes(const double* volume_fraction,
+                      const std::array<const double*, 3>& normal,
+                      const std::array<double*, 3>& wall_sizes_early,
+                      const std::array<double*, 3>& wall_sizes_late) {
+    using V = typename L::V;
+    const V zero = L::set(0.0), half = L::set(0.5), one = L::set(1.0);
+    const V vf = L::load(volume_fraction);
+    const V signed_normal[3] = {L::load(normal[0]), L::load(normal[1]),
+                                L::load(normal[2])};
+    const V n[3] = {L::abs(signed_normal[0]), L::abs(signed_normal[1]),
+                    L::abs(signed_normal[2])};
+    const V alpha = vf * (n[0] + n[1] + n[2]);
+
+    // get_intersect_scalar: the three blocks only differ by a rotation of
+    // the axes
+    V intersect[12];
+    for(int a = 0; a < 3; a++) {
+        const int b = (a + 1) % 3, c = (a + 2) % 3;
+        const auto inside = L::ge(n[a], alpha);
+        const V alpha_var = alpha - n[a];
+        const auto inside_b = L::ge(n[b], alpha_var);
+        const auto inside_c = L::ge(n[c], alpha_var);
+        intersect[a] = L::select(inside, alpha / n[a], one);
+        intersect[3 + 2 * a] = L::select(
+            inside, zero, L::select(inside_b, alpha_var / n[b], one));
+        intersect[4 + 2 * a] = L::select(
+            inside, zero, L::select(inside_c, alpha_var / n[c], one));
+        intersect[9 + a] =
+            L::select(inside, zero,
+                      L::select(inside_b, zero, (alpha_var - n[b]) / n[c]));
+    }
+    const V* I = intersect;
+
+    // The four cases of a wall, depending on which of two edges it is cut by
+    auto cases = [](auto p_cut, auto q_cut, V both, V q_only, V p_only,
+                    V neither) {
+        return L::select(p_cut, L::select(q_cut, both, p_only),
+                         L::select(q_cut, q_only, neither));
+    };
+    V early_rot[3], late_rot[3];
+    early_rot[0] = L::select(
+        L::gt(I[10], zero), one,
+        cases(L::lt(I[1], one), L::lt(I[2], one), half * I[1] * I[2],
+              half * (I[5] + I[2]), half * (I[1] + I[8]),
+              one - half * I[8] * I[5]));
+    late_rot[0] = L::select(
+        L::lt(I[0], one), zero,
+        cases(L::lt(I[3], one), L::lt(I[4], one), half * I[3] * I[4],
+              half * (I[4] + I[9]), half * (I[3] + I[11]),
+              one - half * I[9] * I[11]));
+    early_rot[1] = L::select(
+        L::gt(I[11], zero), one,
+        cases(L::lt(I[0], one), L::lt(I[2], one), half * I[0] * I[2],
+              half * (I[4] + I[2]), half * (I[0] + I[7]),
+              one - half * I[7] * I[4]));
+    late_rot[1] = L::select(
+        L::lt(I[1], one), zero,
+        cases(L::lt(I[5], one), L::lt(I[6], one), half * I[5] * I[6],
+              half * (I[6] + I[10]), half * (I[5] + I[9]),
+              one - half * I[9] * I[10]));
+    early_rot[2] = L::select(
+        L::gt(I[9], zero), one,
+        cases(L::lt(I[0], one), L::lt(I[1], one), half * I[0] * I[1],
+              half * (I[3] + I[1]), half * (I[0] + I[6]),
+              one - half * I[6] * I[3]));
+    late_rot[2] = L::select(
+        L::lt(I[2], one), zero,
+        cases(L::lt(I[7], one), L::lt(I[8], one), half * I[7] * I[8],
+              half * (I[8] + I[11]), half * (I[7] + I[10]),
+              one - half * I[11] * I[10]));
+
+    const auto full = L::ge(vf, one), empty = L::le(vf, zero);
+    for(int dim = 0; dim < 3; dim++) {
+        const auto positive = L::gt(signed_normal[dim], zero);
+        const V early = L::select(positive, early_rot[dim], late_rot[dim]);
+        const V late = L::select(positive, late_rot[dim], early_rot[dim]);
+        L::store(wall_sizes_early[dim],
+                 L::select(full, one, L::select(empty, zero, early)));
+        L::store(wall_sizes_late[dim],
+                 L::select(full, one, L::select(empty, zero, late)));
+    }
+}
+
+// Process the cells from begin while a whole vector fits, and return where
+// it stopped
+template<typename L>
+std::size_t wall_sizes_batch(std::size_t begin, std::size_t end,
+                             std::span<const double> volume_fraction,
+                             const std::array<std::span<const double>, 3>& n,
+                             const std::array<std::span<double>, 3>& early,
+                             const std::array<std::span<double>, 3>& late) {
+    std::size_t i = begin;
+    for(; i + L::width <= end; i += L::width) {
+        wall_sizes_lanes<L>(
+            &volume_fraction[i], {&n[0][i], &n[1][i], &n[2][i]},
+            {&early[0][i], &early[1][i], &early[2][i]},
+            {&late[0][i], &late[1][i], &late[2][i]});
+    }
+    return i;
+}
+
+}
+
+void get_wall_sizes(std::span<const double> volume_fraction,
+                    const std::array<std::span<const double>, 3>& normal,
+                    const std::array<std::span<double>, 3>& wall_sizes_early,
+                    const std::array<std::span<double>, 3>& wall_sizes_late) {
+    const std::size_t n = volume_fraction.size();
+    for(int dim = 0; dim < 3; dim++) {
+        assert(normal[dim].size() == n);
+        assert(wall_sizes_early[dim].size() == n);
+        assert(wall_sizes_late[dim].size() == n);
+    }
+    std::size_t i = 0;
+#if defined(__AVX512F__)
+    i = wall_sizes_batch<Avx512Lanes>(i, n, volume_fraction, normal,
+                                      wall_sizes_early, wall_sizes_late);
+#elif defined(__AVX__)
+    i = wall_sizes_batch<AvxLanes>(i, n, volume_fraction, normal,
+                                   wall_sizes_early, wall_sizes_late);
+#elif defined(__SSE2__)
+    i = wall_sizes_batch<Sse2Lanes>(i, n, volume_fraction, normal,
+                                    wall_sizes_early, wall_sizes_late);
+#endif
+    wall_sizes_batch<ScalarLanes>(i, n, volume_fraction, normal,
+                                  wall_sizes_early, wall_sizes_late);
+}
+
+const char* wall_sizes_instruction_set() {
+#if defined(__AVX512F__)
+    return "avx512";
+#elif defined(__AVX__)
+    return "avx";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
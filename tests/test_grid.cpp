@@ -1,3 +1,4 @@
+#include "arena.hpp"
 #include "grid.hpp"
 #include <gtest/gtest.h>
 
@@ -7,3 +8,96 @@ TEST(GridTest, BasicAssertions) {
     const std::array<std::size_t, 3> coords = {1, 1, 1};
     EXPECT_EQ(&grid[coords[0]][coords[1]][coords[2]], &grid[coords]);
 }
+
+TEST(GridTest, ArenaReusesMemoryAfterReset) {
+    Arena arena;
+    using Allocator = ArenaAllocator<double>;
+    const std::array<std::size_t, 3> last = {99, 99, 99};
+    const double* first_data = nullptr;
+    for(int cycle = 0; cycle < 3; cycle++) {
+        arena.reset();
+        Grid<double, 3, Allocator> a({3, 4, 5}, arena);
+        Grid<std::array<double, 3>, 3, ArenaAllocator<std::array<double, 3>>>
+            b({100, 100, 100}, arena);
+        for(const auto& idxs: a.indices()) EXPECT_EQ(a[idxs], 0);
+        EXPECT_EQ(b[last][2], 0);
+        a[{1, 2, 3}] = 1;
+        b[last][2] = 1;
+        if(cycle == 0)
+            first_data = a.data();
+        EXPECT_EQ(a.data(), first_data);
+    }
+    EXPECT_EQ(arena.nb_upstream_allocations(), 2);
+}
+
+TEST(GridTest, VectorGridStoresComponentPlanes) {
+    VectorGrid<double, 3, 3> grid({2, 3, 4});
+    const std::array<std::size_t, 3> idxs = {1, 2, 3};
+    for(const auto& cell: grid.indices()) EXPECT_EQ(grid[cell][1], 0);
+    grid[idxs] = std::array<double, 3>{1, 2, 3};
+    for(std::size_t c = 0; c < 3; c++) {
+        EXPECT_EQ(&grid[idxs][c], &grid.component(c)[idxs]);
+        EXPECT_EQ(grid.component(c).data(), grid.component(0).data() + c * 24);
+    }
+    const VectorGrid<double, 3, 3> moved(std::move(grid));
+    EXPECT_EQ(moved.shape(), (std::array<std::size_t, 3>{2, 3, 4}));
+    const std::array<double, 3> value = moved[idxs];
+    EXPECT_EQ(value, (std::array<double, 3>{1, 2, 3}));
+}
+
+TEST(GridTest, StencilVisitsInteriorAndBoundaryOnce) {
+    for(const std::size_t width: {1, 2}) {
+        Grid<int, 3> visits({5, 1, 6});
+        Grid<int, 3> big({6, 7, 8});
+        for(auto* grid: {&visits, &big}) {
+            const Stencil<3> stencil(grid->shape(), width);
+            // Split the rows like parallel_for_chunks
+            for(std::size_t row = 0; row < grid->shape()[0]; row++) {
+                stencil.for_each_interior(row, row + 1, [&](std::size_t c) {
+                    grid->data()[c] += 1;
+                });
+                stencil.for_each_boundary(
+                    row, row + 1, [&](const auto& idxs, std::size_t c) {
+                        EXPECT_EQ(c, grid->idx_to_offset(idxs));
+                        EXPECT_EQ(c, stencil.offset(idxs));
+                        grid->data()[c] += 10;
+                    });
+            }
+            for(const auto& idxs: grid->indices()) {
+                bool interior = true;
+                for(int dim = 0; dim < 3; dim++) {
+                    interior = interior and idxs[dim] >= width and
+                               idxs[dim] + width < grid->shape()[dim];
+                }
+                EXPECT_EQ((*grid)[idxs], interior ? 1 : 10);
+            }
+        }
+    }
+    const Stencil<3> stencil(std::array<std::size_t, 3>{6, 7, 8});
+    EXPECT_EQ(stencil.stride(0), 56);
+    EXPECT_EQ(stencil.stride(1), 8);
+    EXPECT_EQ(stencil.stride(2), 1);
+}
+
+TEST(GridTest, BrickGridConvertsFromAndToRowMajor) {
+    // Partial bricks along every dimension
+    const std::array<std::size_t, 3> shape = {5, 9, 6};
+    Grid<int, 3> row_major(shape), round_trip(shape);
+    for(std::size_t c = 0; c < row_major.size(); c++) row_major.data()[c] = c;
+    BrickGrid<int, 3, 4> bricks(shape);
+    bricks.assign(row_major);
+    std::vector<bool> used(2 * 3 * 2 * 64, false);
+    for(const auto& idxs: row_major.indices()) {
+        EXPECT_EQ(bricks[idxs], row_major[idxs]);
+        const std::size_t offset = bricks.idx_to_offset(idxs);
+        ASSERT_LT(offset, used.size());
+        EXPECT_FALSE(used[offset]);
+        used[offset] = true;
+    }
+    // Neighbours in the same brick are close
+    EXPECT_EQ(bricks.idx_to_offset({1, 0, 0}) - bricks.idx_to_offset({0, 0, 0}),
+              16u);
+    bricks.copy_to(round_trip);
+    for(const auto& idxs: row_major.indices())
+        EXPECT_EQ(round_trip[idxs], row_major[idxs]);
+}
@@ -0,0 +1,205 @@
+#include "block_summary.hpp"
+#include "grid.hpp"
+#include "marching_cubes/marching_cubes.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <random>
+#include <span>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace waves_on_cuda::marching_cubes;
+using Triangles = std::vector<geometry::Triangle<float>>;
+
+namespace {
+
+// A wavy surface across the last axis, smeared over a few cells
+void fill_wavy_surface(Grid<double, 3>& grid) {
+    const double height = grid.shape()[2];
+    for(const auto& [i, j, k]: grid.indices()) {
+        const double surface =
+            height * (0.5 + 0.2 * std::sin(0.4 * i) * std::cos(0.3 * j));
+        grid[{i, j, k}] = std::clamp(surface - k, 0.0, 1.0);
+    }
+}
+
+// The corners of every triangle, which compare exactly
+std::vector<std::array<float, 9>> corners(const Triangles& triangles) {
+    std::vector<std::array<float, 9>> result;
+    for(const auto& triangle: triangles) {
+        std::array<float, 9>& points = result.emplace_back();
+        for(int c = 0; c < 3; c++) {
+            points[3 * c] = triangle.corners[c].x;
+            points[3 * c + 1] = triangle.corners[c].y;
+            points[3 * c + 2] = triangle.corners[c].z;
+        }
+    }
+    return result;
+}
+
+// Same, sorted, for the triangles that come in another order
+std::vector<std::array<float, 9>> sorted_corners(const Triangles& triangles) {
+    auto result = corners(triangles);
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
+TEST(MarchingCubesTest, BrickGridMatchesRowMajorOnAnyShape) {
+    for(const std::array<std::size_t, 3> shape:
+        {std::array<std::size_t, 3>{24, 24, 24}, {20, 27, 35}, {35, 20, 9}}) {
+        Grid<double, 3> grid(shape);
+        fill_wavy_surface(grid);
+        BrickGrid<double, 3> bricks(shape);
+        bricks.assign(grid);
+        const Triangles triangles = marching_cubes(grid, 0.5);
+        EXPECT_FALSE(triangles.empty());
+        EXPECT_EQ(corners(marching_cubes(bricks, 0.5)), corners(triangles));
+        // Every corner is on the grid, which spans [0, 1] along each axis
+        for(const auto& points: corners(triangles)) {
+            for(const float coordinate: points) {
+                EXPECT_GE(coordinate, 0);
+                EXPECT_LE(coordinate, 1);
+            }
+        }
+    }
+}
+
+TEST(MarchingCubesTest, SkippingUniformBlocksMatchesAllCubes) {
+    for(const std::array<std::size_t, 3> shape:
+        {std::array<std::size_t, 3>{40, 40, 40}, {20, 27, 35}, {35, 20, 9}}) {
+        Grid<double, 3> grid(shape);
+        fill_wavy_surface(grid);
+        BlockSummary blocks(shape);
+        for(std::size_t b = 0; b < blocks.nb_blocks(); b++)
+            blocks.update_fraction(grid, b);
+        std::size_t skipped = 0;
+        EXPECT_EQ(corners(marching_cubes(grid, 0.5, blocks, &skipped)),
+                  corners(marching_cubes(grid, 0.5)));
+        EXPECT_GT(skipped, 0);
+    }
+}
+
+TEST(MarchingCubesTest, IndexedMeshSharesTheVerticesOfTheTriangles) {
+    for(const std::array<std::size_t, 3> shape:
+        {std::array<std::size_t, 3>{24, 24, 24}, {20, 27, 35}}) {
+        Grid<double, 3> grid(shape);
+        fill_wavy_surface(grid);
+        const auto mesh = marching_cubes_indexed(grid, 0.5);
+        ASSERT_EQ(mesh.indices.size() % 3, 0);
+        Triangles expanded(mesh.indices.size() / 3);
+        for(std::size_t i = 0; i < mesh.indices.size(); i++) {
+            ASSERT_LT(mesh.indices[i], mesh.vertices.size());
+            expanded[i / 3].corners[i % 3] = mesh.vertices[mesh.indices[i]];
+        }
+        EXPECT_EQ(sorted_corners(expanded),
+                  sorted_corners(marching_cubes(grid, 0.5)));
+        // Every vertex is on about six triangles
+        EXPECT_LT(3 * mesh.vertices.size(), mesh.indices.size());
+    }
+}
+
+TEST(MarchingCubesTest, SlabsMatchTheSerialMesherOnAnyThreadCount) {
+    // Along the first axis, 37 is not a whole number of slabs
+    Grid<double, 3> grid({37, 20, 25});
+    fill_wavy_surface(grid);
+    ThreadPool serial_pool(1), pool(4);
+    const auto serial = corners(marching_cubes(grid, 0.5, serial_pool));
+    EXPECT_FALSE(serial.empty());
+    EXPECT_EQ(corners(marching_cubes(grid, 0.5, pool)), serial);
+    EXPECT_EQ(corners(marching_cubes(grid, 0.5)), serial);
+}
+
+TEST(MarchingCubesTest, TwoPassesMatchTheSlabsOnNoise) {
+    // Noise gives every configuration of the corners, the ambiguous ones
+    // too, whose number of triangles the table of counts does not hold
+    Grid<double, 3> grid({12, 13, 14});
+    std::mt19937 random(3);
+    std::uniform_real_distribution<double> noise(0, 1);
+    for(const auto& idxs: grid.indices()) grid[idxs] = noise(random);
+    ThreadPool pool(2);
+    const Triangles slabs = marching_cubes(grid, 0.5, pool);
+
+    const CubeCounts counts = count_triangles(grid, 0.5);
+    ASSERT_EQ(counts.total(), slabs.size());
+    // Into memory the caller got, past a first triangle left alone
+    Triangles buffer(counts.total() + 1);
+    buffer[0].corners[0].x = -1;
+    fill_triangles(grid, 0.5, counts,
+                   std::span(buffer).subspan(1, counts.total()));
+    EXPECT_EQ(buffer[0].corners[0].x, -1);
+    buffer.erase(buffer.begin());
+    EXPECT_EQ(corners(buffer), corners(slabs));
+
+    // The number of every cube is that of the cube meshed on its own
+    Grid<double, 3> cube({2, 2, 2});
+    std::size_t c = 0;
+    for(std::size_t z = 0; z + 1 < grid.shape()[0]; z++) {
+        for(std::size_t y = 0; y + 1 < grid.shape()[1]; y++) {
+            for(std::size_t x = 0; x + 1 < grid.shape()[2]; x++, c++) {
+                for(const auto& [i, j, k]: cube.indices())
+                    cube[{i, j, k}] = grid[{z + i, y + j, x + k}];
+                ASSERT_EQ(counts.triangles[c],
+                          marching_cubes(cube, 0.5).size());
+            }
+        }
+    }
+    EXPECT_EQ(c, counts.triangles.size());
+}
+
+TEST(MarchingCubesTest, IncrementalMesherRemeshesTheBlocksThatChanged) {
+    constexpr std::size_t block_size = IncrementalMesher::block_size;
+    const std::array<std::size_t, 3> shape = {40, 35, 50};
+    Grid<double, 3> grid(shape);
+    fill_wavy_surface(grid);
+    std::array<std::size_t, 3> nblocks;
+    for(int dim = 0; dim < 3; dim++)
+        nblocks[dim] = (shape[dim] - 1 + block_size - 1) / block_size;
+    IncrementalMesher mesher(0.5);
+    auto all_triangles = [&]() {
+        Triangles result;
+        for(std::size_t b = 0; b < mesher.nb_blocks(); b++) {
+            const auto& triangles = mesher.triangles(b);
+            result.insert(result.end(), triangles.begin(), triangles.end());
+        }
+        return result;
+    };
+
+    std::vector<std::size_t> changed = mesher.update(grid);
+    ASSERT_EQ(mesher.nb_blocks(), nblocks[0] * nblocks[1] * nblocks[2]);
+    EXPECT_EQ(changed.size(), mesher.nb_blocks());
+    EXPECT_EQ(sorted_corners(all_triangles()),
+              sorted_corners(marching_cubes(grid, 0.5)));
+
+    // A cell is a corner of the cubes before and after it along every axis,
+    // which may be in the next blocks
+    std::vector<std::size_t> expected;
+    for(const std::array<std::size_t, 3> cell:
+        {std::array<std::size_t, 3>{16, 10, 32}, {39, 34, 0}, {5, 20, 20}}) {
+        grid[cell] = grid[cell] > 0.5 ? 0.1 : 0.9;
+        for(int cube = 0; cube < 8; cube++) {
+            std::array<std::size_t, 3> block;
+            bool inside = true;
+            for(int dim = 0; dim < 3; dim++) {
+                const std::size_t first = cell[dim] - ((cube >> dim) & 1);
+                inside = inside and cell[dim] >= ((cube >> dim) & 1) and
+                         first + 1 < shape[dim];
+                block[dim] = first / block_size;
+            }
+            if(inside)
+                expected.push_back((block[0] * nblocks[1] + block[1]) *
+                                       nblocks[2] +
+                                   block[2]);
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+    expected.erase(std::unique(expected.begin(), expected.end()),
+                   expected.end());
+    EXPECT_EQ(mesher.update(grid), expected);
+    EXPECT_EQ(sorted_corners(all_triangles()),
+              sorted_corners(marching_cubes(grid, 0.5)));
+    EXPECT_TRUE(mesher.update(grid).empty());
+}
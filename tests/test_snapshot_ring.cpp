@@ -0,0 +1,34 @@
+#include "grid.hpp"
+#include "snapshot_ring.hpp"
+#include <gtest/gtest.h>
+
+TEST(SnapshotRingTest, KeepsOnlyTheLatest) {
+    SnapshotRing<Grid<int, 3>> ring(std::array<std::size_t, 3>{2, 2, 2});
+    const std::array<std::size_t, 3> origin = {0, 0, 0};
+    std::uint64_t seen = 0;
+    EXPECT_EQ(ring.read_latest(seen), nullptr);
+
+    // Snapshots published before the consumer reads are dropped
+    for(int value = 1; value <= 3; value++) {
+        ring.acquire()[origin] = value;
+        EXPECT_EQ(ring.publish(), value);
+    }
+    const Grid<int, 3>* read = ring.read_latest(seen);
+    ASSERT_NE(read, nullptr);
+    EXPECT_EQ(seen, 3);
+    EXPECT_EQ((*read)[origin], 3);
+    EXPECT_EQ(ring.read_latest(seen), nullptr);
+
+    // The producer never writes into the slot being read
+    for(int value = 4; value <= 10; value++) {
+        Grid<int, 3>& slot = ring.acquire();
+        EXPECT_NE(&slot, read);
+        slot[origin] = value;
+        ring.publish();
+        EXPECT_EQ((*read)[origin], 3);
+    }
+    read = ring.read_latest(seen);
+    EXPECT_EQ(seen, 10);
+    EXPECT_EQ((*read)[origin], 10);
+    EXPECT_EQ(ring.latest_generation(), 10);
+}
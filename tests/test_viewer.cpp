@@ -0,0 +1,261 @@
+#include "my_glfw.hpp"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <span>
+#include <utility>
+#include <vector>
+
+/*
+Replays the uploads of meshes into the buffers of the viewer on a headless
+OpenGL context, e.g. Mesa's software driver (llvmpipe) with the surfaceless
+EGL platform, and reads back the vertices the draws of render() read. The
+tests are skipped where no such context can be created.
+*/
+
+namespace {
+
+// Surfaceless OpenGL context, current while it lives
+class HeadlessContext {
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+
+public:
+    HeadlessContext() {
+        const auto get_platform_display =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+                eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if(not get_platform_display)
+            return;
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                       EGL_DEFAULT_DISPLAY, nullptr);
+        if(display == EGL_NO_DISPLAY or
+           not eglInitialize(display, nullptr, nullptr)) {
+            display = EGL_NO_DISPLAY;
+            return;
+        }
+        if(eglBindAPI(EGL_OPENGL_API))
+            context = eglCreateContext(display, EGL_NO_CONFIG_KHR,
+                                       EGL_NO_CONTEXT, nullptr);
+        if(context != EGL_NO_CONTEXT and
+           not eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                              context)) {
+            eglDestroyContext(display, context);
+            context = EGL_NO_CONTEXT;
+        }
+    }
+    HeadlessContext(const HeadlessContext&) = delete;
+    ~HeadlessContext() {
+        if(context != EGL_NO_CONTEXT) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                           EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+        }
+        if(display != EGL_NO_DISPLAY)
+            eglTerminate(display);
+    }
+    bool current() const {
+        return context != EGL_NO_CONTEXT;
+    }
+};
+
+// Viewer without a window, whose buffers the tests read back
+class HeadlessViewer: public MyGLFW {
+public:
+    HeadlessViewer() {
+        create_buffers();
+    }
+    std::size_t nb_triangles() const {
+        return nbTriangles;
+    }
+    // In bytes
+    std::size_t vertex_capacity() const {
+        return vbo_capacity;
+    }
+    // First vertex of every block
+    const std::vector<GLint>& block_vertices() const {
+        return block_first;
+    }
+    // Whether the blocks fit in their room, which does not overlap that of
+    // the other blocks, inside the vertex buffer
+    bool blocks_fit() const {
+        std::vector<std::pair<GLint, GLint>> rooms;
+        for(std::size_t b = 0; b < block_first.size(); b++) {
+            if(block_count[b] > block_capacity[b])
+                return false;
+            rooms.emplace_back(block_first[b],
+                               block_first[b] + block_capacity[b]);
+        }
+        std::sort(rooms.begin(), rooms.end());
+        for(std::size_t b = 1; b < rooms.size(); b++) {
+            if(rooms[b].first < rooms[b - 1].second)
+                return false;
+        }
+        return rooms.empty() or
+               rooms.back().second * 3 * sizeof(GLfloat) <= vbo_capacity;
+    }
+    // Vertices of the triangles that render() draws, in the order it draws
+    // them
+    std::vector<GLfloat> drawn_vertices() const {
+        std::vector<GLfloat> result(9 * nbTriangles);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        if(_layout == INDEXED and nbTriangles > 0) {
+            std::vector<GLuint> indices(3 * nbTriangles);
+            glBindVertexArray(vao);
+            glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0,
+                               indices.size() * sizeof(GLuint),
+                               indices.data());
+            glBindVertexArray(0);
+            std::vector<GLfloat> vertices(
+                3 * (*std::max_element(indices.begin(), indices.end()) + 1));
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0,
+                               vertices.size() * sizeof(GLfloat),
+                               vertices.data());
+            for(std::size_t i = 0; i < indices.size(); i++) {
+                std::copy_n(&vertices[3 * indices[i]], 3, &result[3 * i]);
+            }
+        } else if(_layout == BLOCKS) {
+            result.clear();
+            for(std::size_t b = 0; b < block_first.size(); b++) {
+                const std::size_t begin = result.size();
+                result.resize(begin + 3 * block_count[b]);
+                glGetBufferSubData(GL_ARRAY_BUFFER,
+                                   3 * block_first[b] * sizeof(GLfloat),
+                                   3 * block_count[b] * sizeof(GLfloat),
+                                   result.data() + begin);
+            }
+        } else {
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0,
+                               result.size() * sizeof(GLfloat), result.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return result;
+    }
+};
+
+class ViewerTest: public testing::Test {
+protected:
+    HeadlessContext context;
+
+    void SetUp() override {
+        if(not context.current())
+            GTEST_SKIP() << "No headless OpenGL context";
+        // GLEW loads the functions of the context, and then fails to find
+        // a GLX display, which it does not need
+        glewExperimental = GL_TRUE;
+        const GLenum status = glewInit();
+        if(status != GLEW_OK and status != GLEW_ERROR_NO_GLX_DISPLAY)
+            GTEST_SKIP() << "GLEW does not load EGL contexts";
+    }
+};
+
+// Triangles with distinct coordinates, seeded by first
+std::vector<GLfloat> triangles(std::size_t nb_triangles, GLfloat first) {
+    std::vector<GLfloat> result(9 * nb_triangles);
+    for(std::size_t i = 0; i < result.size(); i++) result[i] = first + i;
+    return result;
+}
+
+}
+
+TEST_F(ViewerTest, ReplayedMeshesReuseOneVertexBuffer) {
+    HeadlessViewer viewer;
+    EXPECT_EQ(viewer.nb_triangles(), 0);
+    std::mt19937 random(1);
+    std::uniform_int_distribution<std::size_t> sizes(1000, 51000);
+    std::size_t largest = 0;
+    for(int mesh = 0; mesh < 100; mesh++) {
+        std::vector<GLfloat> vertices = triangles(sizes(random), mesh);
+        viewer.set_triangles(vertices);
+        largest = std::max(largest, vertices.size() * sizeof(GLfloat));
+        EXPECT_EQ(viewer.nb_triangles(), vertices.size() / 9);
+        EXPECT_EQ(viewer.drawn_vertices(), vertices);
+        // The buffer at most doubles past the largest mesh
+        EXPECT_GE(viewer.vertex_capacity(), vertices.size() * sizeof(GLfloat));
+        EXPECT_LE(viewer.vertex_capacity(), 2 * largest);
+        ASSERT_EQ(glGetError(), GL_NO_ERROR);
+    }
+}
+
+TEST_F(ViewerTest, IndexedMeshesDrawTheirTriangles) {
+    HeadlessViewer viewer;
+    std::mt19937 random(2);
+    std::uniform_int_distribution<std::size_t> sizes(100, 5000);
+    for(int mesh = 0; mesh < 20; mesh++) {
+        // Triangle soups in between, which share the vertex buffer
+        if(mesh % 4 == 3) {
+            std::vector<GLfloat> vertices = triangles(sizes(random), mesh);
+            viewer.set_triangles(vertices);
+            EXPECT_EQ(viewer.drawn_vertices(), vertices);
+            continue;
+        }
+        const std::size_t nb_vertices = sizes(random);
+        const std::vector<GLfloat> vertices =
+            triangles((nb_vertices + 2) / 3, mesh);
+        std::uniform_int_distribution<GLuint> vertex(0, nb_vertices - 1);
+        std::vector<GLuint> indices(3 * sizes(random));
+        for(GLuint& index: indices) index = vertex(random);
+        viewer.set_indexed_triangles(vertices, indices);
+        std::vector<GLfloat> expanded;
+        for(const GLuint index: indices) {
+            expanded.insert(expanded.end(), &vertices[3 * index],
+                            &vertices[3 * index + 3]);
+        }
+        EXPECT_EQ(viewer.nb_triangles(), indices.size() / 3);
+        EXPECT_EQ(viewer.drawn_vertices(), expanded);
+        ASSERT_EQ(glGetError(), GL_NO_ERROR);
+    }
+}
+
+TEST_F(ViewerTest, BlocksGrowInPlaceOrMove) {
+    HeadlessViewer viewer;
+    std::mt19937 random(4);
+    std::uniform_int_distribution<std::size_t> sizes(0, 200);
+    std::vector<std::vector<GLfloat>> blocks;
+    int moves = 0;
+    auto block_triangles = [&](std::size_t b) {
+        return std::span<const GLfloat>(blocks[b]);
+    };
+    for(int update = 0; update < 200; update++) {
+        std::vector<std::size_t> changed;
+        // The number of blocks changes from time to time, which uploads all
+        // of them
+        if(update % 50 == 0) {
+            blocks.resize(32 + update / 5);
+            for(std::size_t b = 0; b < blocks.size(); b++)
+                changed.push_back(b);
+        } else {
+            const std::size_t last = blocks.size() - 1;
+            std::uniform_int_distribution<std::size_t> block(0, last);
+            for(int i = 0; i < 4; i++) changed.push_back(block(random));
+            std::sort(changed.begin(), changed.end());
+            changed.erase(std::unique(changed.begin(), changed.end()),
+                          changed.end());
+        }
+        // Every seventh update, the blocks at least triple, past their room
+        for(const std::size_t b: changed) {
+            const std::size_t nb_triangles =
+                update % 7 == 0 ? blocks[b].size() / 9 * 3 + sizes(random)
+                                : sizes(random);
+            blocks[b] = triangles(nb_triangles, 1000 * update + b);
+        }
+        const std::vector<GLint> before = viewer.block_vertices();
+        viewer.set_block_triangles(blocks.size(), changed, block_triangles);
+        // Blocks that outgrow their room move, alone or with a new layout
+        if(before.size() == blocks.size()) {
+            for(const std::size_t b: changed)
+                moves += before[b] != viewer.block_vertices()[b];
+        }
+        std::vector<GLfloat> expected;
+        for(const auto& block: blocks)
+            expected.insert(expected.end(), block.begin(), block.end());
+        EXPECT_EQ(viewer.nb_triangles(), expected.size() / 9);
+        EXPECT_TRUE(viewer.blocks_fit());
+        EXPECT_EQ(viewer.drawn_vertices(), expected);
+        ASSERT_EQ(glGetError(), GL_NO_ERROR);
+    }
+    EXPECT_GT(moves, 0);
+}
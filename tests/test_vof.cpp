@@ -1,6 +1,14 @@
 #include "grid.hpp"
+#include "vof/ensemble.hpp"
+#include "vof/intersect.hpp"
+#include "vof/normals.hpp"
 #include "vof/vof.hpp"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <sstream>
 
 template<typename dtype>
 #ifdef NO_CUDA
@@ -9,6 +17,18 @@ using Allocator = std::allocator<dtype>;
 using Allocator = CUDAAllocator<dtype>;
 #endif
 
+// A tilted interface, so that there are mixed cells, shifted by offset cells
+// along the last axis
+template<typename VolumeFraction>
+void fill_tilted_interface(VolumeFraction& volume_fraction, double offset = 0) {
+    for(const auto& [i, j, k]: volume_fraction.indices()) {
+        volume_fraction[i][j][k] =
+            std::clamp(static_cast<double>(i + j) / 4.0 -
+                           static_cast<double>(k) + offset,
+                       0.0, 1.0);
+    }
+}
+
 TEST(VofTest, StaticScenario) {
     using dtype = int;
     const double dt = 0.01;
@@ -23,3 +43,498 @@ TEST(VofTest, StaticScenario) {
         EXPECT_NEAR(out.volume_fraction[idxs], 1.0, 1e-5);
     }
 }
+
+TEST(VofTest, ThreadCountDoesNotChangeResult) {
+    const double dt = 0.01;
+
+    StaggeredGrid<Allocator<double>> in({8, 9, 10});
+    fill_tilted_interface(in.volume_fraction);
+    StaggeredGrid<Allocator<double>> out_serial(in.volume_fraction.shape()),
+        out_threaded(in.volume_fraction.shape());
+    VOF<Allocator>(1).step(in, out_serial, 0, dt);
+    VOF<Allocator>(4).step(in, out_threaded, 0, dt);
+    for(const auto& idxs: in.volume_fraction.indices()) {
+        EXPECT_EQ(out_serial.volume_fraction[idxs],
+                  out_threaded.volume_fraction[idxs]);
+        EXPECT_EQ(out_serial.pressure[idxs], out_threaded.pressure[idxs]);
+    }
+    for(int dim = 0; dim < ndim; dim++) {
+        for(const auto& idxs: in.u[dim].indices()) {
+            EXPECT_EQ(out_serial.u[dim][idxs], out_threaded.u[dim][idxs]);
+        }
+    }
+}
+
+TEST(VofTest, MatrixFreePressureMatchesEigen) {
+    const double dt = 0.01;
+
+    StaggeredGrid<Allocator<double>> in({6, 7, 8});
+    fill_tilted_interface(in.volume_fraction);
+    StaggeredGrid<Allocator<double>> out_eigen(in.volume_fraction.shape()),
+        out_matrix_free(in.volume_fraction.shape());
+    VOF<Allocator>(1, {.kind = PressureSolverKind::EigenCG})
+        .step(in, out_eigen, 0, dt);
+    VOF<Allocator>(2, {.kind = PressureSolverKind::MatrixFreeCG})
+        .step(in, out_matrix_free, 0, dt);
+    for(const auto& idxs: in.volume_fraction.indices()) {
+        EXPECT_NEAR(out_eigen.pressure[idxs], out_matrix_free.pressure[idxs],
+                    1e-8);
+        EXPECT_NEAR(out_eigen.volume_fraction[idxs],
+                    out_matrix_free.volume_fraction[idxs], 1e-8);
+    }
+}
+
+TEST(VofTest, MultigridPressureMatchesEigen) {
+    const double dt = 0.01;
+
+    StaggeredGrid<Allocator<double>> in({9, 8, 10});
+    fill_tilted_interface(in.volume_fraction);
+    StaggeredGrid<Allocator<double>> out_eigen(in.volume_fraction.shape());
+    VOF<Allocator>(1, {.kind = PressureSolverKind::EigenCG})
+        .step(in, out_eigen, 0, dt);
+    for(const auto kind:
+        {PressureSolverKind::Multigrid, PressureSolverKind::MultigridCG}) {
+        StaggeredGrid<Allocator<double>> out(in.volume_fraction.shape());
+        const VOF<Allocator> scheme(2, {.kind = kind});
+        scheme.step(in, out, 0, dt);
+        EXPECT_GT(scheme.pressure_solver_stats().iterations, 0u);
+        EXPECT_LT(scheme.pressure_solver_stats().residual, 1e-10);
+        for(const auto& idxs: in.volume_fraction.indices()) {
+            EXPECT_NEAR(out_eigen.pressure[idxs], out.pressure[idxs], 1e-8);
+        }
+    }
+}
+
+TEST(VofTest, DensityRatioReachesEverySolver) {
+    const double dt = 0.01;
+    const double light_density = light_density_of_ratio(1001);
+
+    StaggeredGrid<Allocator<double>> in({8, 6, 7});
+    fill_tilted_interface(in.volume_fraction);
+    StaggeredGrid<Allocator<double>> out_default(in.volume_fraction.shape()),
+        out_eigen(in.volume_fraction.shape());
+    VOF<Allocator>(1).step(in, out_default, 0, dt);
+    VOF<Allocator>(1, {.kind = PressureSolverKind::EigenCG,
+                       .light_density = light_density})
+        .step(in, out_eigen, 0, dt);
+    double difference = 0;
+    for(const auto& idxs: in.volume_fraction.indices()) {
+        difference = std::max(difference, std::abs(out_default.pressure[idxs] -
+                                                    out_eigen.pressure[idxs]));
+    }
+    EXPECT_GT(difference, 1e-6);
+    for(const auto kind:
+        {PressureSolverKind::MatrixFreeCG, PressureSolverKind::MultigridCG}) {
+        StaggeredGrid<Allocator<double>> out(in.volume_fraction.shape());
+        VOF<Allocator>(2, {.kind = kind, .light_density = light_density})
+            .step(in, out, 0, dt);
+        for(const auto& idxs: in.volume_fraction.indices()) {
+            EXPECT_NEAR(out_eigen.pressure[idxs], out.pressure[idxs], 1e-8);
+        }
+        for(int dim = 0; dim < ndim; dim++) {
+            for(const auto& idxs: in.u[dim].indices())
+                EXPECT_NEAR(out_eigen.u[dim][idxs], out.u[dim][idxs], 1e-8);
+        }
+    }
+}
+
+TEST(VofTest, PersistentPressureSolverMatchesFreshSolver) {
+    const double dt = 0.01;
+    const std::array<std::size_t, 3> shape = {8, 7, 9};
+    auto init = [&](StaggeredGrid<Allocator<double>>& grid) {
+        for(const auto& [i, j, k]: grid.volume_fraction.indices()) {
+            grid.volume_fraction[i][j][k] = std::clamp(
+                static_cast<double>(i + 2 * j) / 5.0 - static_cast<double>(k),
+                0.0, 1.0);
+        }
+    };
+
+    for(const auto kind:
+        {PressureSolverKind::EigenCG, PressureSolverKind::MultigridCG}) {
+        // The same scheme for every step, and a new one for every step
+        const VOF<Allocator> scheme(2, {.kind = kind});
+        StaggeredGrid<Allocator<double>> grids[4] = {shape, shape, shape,
+                                                     shape};
+        auto *front = &grids[0], *back = &grids[1];
+        auto *fresh_front = &grids[2], *fresh_back = &grids[3];
+        init(*front);
+        init(*fresh_front);
+        for(int step = 0; step < 3; step++) {
+            scheme.step(*front, *back, 0, dt);
+            VOF<Allocator>(2, {.kind = kind})
+                .step(*fresh_front, *fresh_back, 0, dt);
+            for(const auto& idxs: front->volume_fraction.indices()) {
+                ASSERT_EQ(back->pressure[idxs], fresh_back->pressure[idxs]);
+                ASSERT_EQ(back->volume_fraction[idxs],
+                          fresh_back->volume_fraction[idxs]);
+            }
+            std::swap(front, back);
+            std::swap(fresh_front, fresh_back);
+        }
+    }
+}
+
+TEST(VofTest, StepMaintainsInterfaceCells) {
+    const double dt = 0.01;
+    const std::array<std::size_t, 3> shape = {7, 8, 9};
+    StaggeredGrid<Allocator<double>> in(shape), out(shape), next(shape),
+        next_from_scan(shape);
+    fill_tilted_interface(in.volume_fraction, 2);
+    const VOF<Allocator> scheme(3);
+    scheme.step(in, out, 0, dt);
+
+    ASSERT_TRUE(out.interface_valid);
+    std::vector<std::size_t> mixed;
+    for(std::size_t c = 0; c < out.volume_fraction.size(); c++) {
+        const double vf = out.volume_fraction.data()[c];
+        if(0 < vf and vf < 1)
+            mixed.push_back(c);
+    }
+    EXPECT_FALSE(mixed.empty());
+    EXPECT_EQ(out.interface_cells, mixed);
+
+    // Same result whether the interface comes with the grid or is rebuilt
+    scheme.step(out, next, dt, dt);
+    out.interface_valid = false;
+    scheme.step(out, next_from_scan, dt, dt);
+    for(const auto& idxs: out.volume_fraction.indices()) {
+        EXPECT_EQ(next.volume_fraction[idxs],
+                  next_from_scan.volume_fraction[idxs]);
+    }
+    EXPECT_EQ(next.interface_cells, next_from_scan.interface_cells);
+}
+
+TEST(VofTest, BatchedWallSizesMatchScalar) {
+    // Not a multiple of any vector width, to exercise the scalar tail
+    const std::size_t n = 1001;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<double> vf(n), normal[3], early[3], late[3];
+    for(int dim = 0; dim < 3; dim++) {
+        normal[dim].resize(n);
+        early[dim].resize(n);
+        late[dim].resize(n);
+    }
+    for(std::size_t c = 0; c < n; c++) {
+        vf[c] = c % 17 == 0 ? 0.0 : c % 19 == 0 ? 1.0 : std::abs(uniform(rng));
+        std::array<double, 3> cell_normal;
+        for(int dim = 0; dim < 3; dim++) {
+            // Also cover the normals along the walls and the axes
+            cell_normal[dim] = c % (5 + dim) == 0 ? 0.0 : uniform(rng);
+        }
+        if(cell_normal == std::array<double, 3>{0, 0, 0})
+            cell_normal[0] = -1;
+        const double norm = std::sqrt(cell_normal[0] * cell_normal[0] +
+                                      cell_normal[1] * cell_normal[1] +
+                                      cell_normal[2] * cell_normal[2]);
+        for(int dim = 0; dim < 3; dim++)
+            normal[dim][c] = cell_normal[dim] / norm;
+    }
+    get_wall_sizes(vf, {normal[0], normal[1], normal[2]},
+                   {early[0], early[1], early[2]}, {late[0], late[1], late[2]});
+
+    for(std::size_t c = 0; c < n; c++) {
+        std::array<double, 3> cell_normal = {normal[0][c], normal[1][c],
+                                             normal[2][c]};
+        const auto [expected_early, expected_late] =
+            get_wall_sizes(vf[c], cell_normal);
+        for(int dim = 0; dim < 3; dim++) {
+            EXPECT_DOUBLE_EQ(early[dim][c], expected_early[dim]) << c;
+            EXPECT_DOUBLE_EQ(late[dim][c], expected_late[dim]) << c;
+        }
+    }
+}
+
+TEST(VofTest, FusedTransportVelocityMatchesTwoPass) {
+    const double dt = 0.01;
+    const std::array<std::size_t, 3> shape = {9, 7, 8};
+    StaggeredGrid<Allocator<double>> in(shape), out_fused(shape),
+        out_two_pass(shape);
+    fill_tilted_interface(in.volume_fraction, 2);
+    // A velocity field, so that u_i u_j does not vanish
+    for(int dim = 0; dim < ndim; dim++) {
+        for(const auto& [i, j, k]: in.u[dim].indices())
+            in.u[dim][i][j][k] = std::sin(i + 2.0 * j + 3.0 * k + dim) / 10;
+    }
+    VOF<Allocator>(3, {}, true).step(in, out_fused, 0, dt);
+    VOF<Allocator>(3, {}, false).step(in, out_two_pass, 0, dt);
+    for(const auto& idxs: in.volume_fraction.indices()) {
+        EXPECT_DOUBLE_EQ(out_fused.volume_fraction[idxs],
+                         out_two_pass.volume_fraction[idxs]);
+        EXPECT_DOUBLE_EQ(out_fused.pressure[idxs], out_two_pass.pressure[idxs]);
+    }
+    for(int dim = 0; dim < ndim; dim++) {
+        for(const auto& idxs: in.u[dim].indices())
+            EXPECT_DOUBLE_EQ(out_fused.u[dim][idxs], out_two_pass.u[dim][idxs]);
+    }
+}
+
+TEST(VofTest, TileNormalsMatchCellNormals) {
+    // Partial tiles along every axis, and values that need clamping
+    const std::array<std::size_t, 3> shape = {11, 9, 13};
+    Grid<double, 3> vf(shape);
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> uniform(-0.2, 1.2);
+    for(const auto& idxs: vf.indices()) vf[idxs] = uniform(rng);
+    auto neighbour = [&](const std::array<std::size_t, 3>& idxs, int di,
+                         int dj, int dk) {
+        return vf[{WallBoundary::neighbour(idxs[0], di, shape[0]),
+                   WallBoundary::neighbour(idxs[1], dj, shape[1]),
+                   WallBoundary::neighbour(idxs[2], dk, shape[2])}];
+    };
+
+    MixedYoungCenteredTile<WallBoundary> tile;
+    const std::size_t size = tile.size;
+    for(std::size_t i = 0; i < shape[0]; i += size) {
+        for(std::size_t j = 0; j < shape[1]; j += size) {
+            for(std::size_t k = 0; k < shape[2]; k += size) {
+                tile.load(vf, {i, j, k});
+                for(const auto& idxs: vf.indices()) {
+                    if(idxs[0] / size != i / size or
+                       idxs[1] / size != j / size or idxs[2] / size != k / size)
+                        continue;
+                    const auto normal = tile.normal(idxs);
+                    const auto expected =
+                        mixed_young_centered([&](int di, int dj, int dk) {
+                            return neighbour(idxs, di, dj, dk);
+                        });
+                    // The 27-point sum, in another order
+                    std::array<double, 3> sum = {0, 0, 0};
+                    for(int di = -1; di <= 1; di++) {
+                        for(int dj = -1; dj <= 1; dj++) {
+                            for(int dk = -1; dk <= 1; dk++) {
+                                const int diff =
+                                    (di != 0) + (dj != 0) + (dk != 0);
+                                const double weight = diff == 1   ? 4
+                                                      : diff == 2 ? 2
+                                                                  : 1;
+                                const double cell_vf = std::clamp(
+                                    neighbour(idxs, di, dj, dk), 0.0, 1.0);
+                                sum[0] -= di * cell_vf * weight;
+                                sum[1] -= dj * cell_vf * weight;
+                                sum[2] -= dk * cell_vf * weight;
+                            }
+                        }
+                    }
+                    const double norm = std::sqrt(
+                        sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    for(int dim = 0; dim < 3; dim++) {
+                        EXPECT_EQ(normal[dim], expected[dim]);
+                        EXPECT_NEAR(normal[dim], sum[dim] / norm, 1e-12);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(VofTest, FloatStorageFollowsDouble) {
+    const double dt = 0.01;
+    const std::array<std::size_t, 3> shape = {8, 9, 10};
+    StaggeredGrid<Allocator<double>> in(shape), out(shape);
+    StaggeredGrid<Allocator<float>> in_float(shape), out_float(shape);
+    fill_tilted_interface(in.volume_fraction);
+    fill_tilted_interface(in_float.volume_fraction);
+    // One step only: the scheme branches on the volume fraction (e.g.
+    // >= 0.5), so later steps can differ by more than the rounding
+    VOF<Allocator>(2).step(in, out, 0, dt);
+    VOF<Allocator, WallBoundary, float>(2).step(in_float, out_float, 0, dt);
+    for(const auto& idxs: in.volume_fraction.indices()) {
+        EXPECT_NEAR(out_float.volume_fraction[idxs], out.volume_fraction[idxs],
+                    1e-6);
+        EXPECT_NEAR(out_float.pressure[idxs], out.pressure[idxs], 1e-6);
+    }
+    for(int dim = 0; dim < ndim; dim++) {
+        for(const auto& idxs: in.u[dim].indices())
+            EXPECT_NEAR(out_float.u[dim][idxs], out.u[dim][idxs], 1e-6);
+    }
+}
+
+TEST(VofTest, QuantizedVolumeFractionFollowsDouble) {
+    // 0 and 1 are exact, and the other values round to the nearest step
+    EXPECT_EQ(static_cast<double>(UNorm16(0.0)), 0.0);
+    EXPECT_EQ(static_cast<double>(UNorm16(1.0)), 1.0);
+    EXPECT_EQ(static_cast<double>(UNorm16(-0.5)), 0.0);
+    EXPECT_EQ(static_cast<double>(UNorm16(1.5)), 1.0);
+    for(double value: {1e-6, 0.25, 0.5, 1 - 1e-6})
+        EXPECT_NEAR(UNorm16(value), value, 0.5 / 65535);
+
+    const double dt = 0.01;
+    const std::array<std::size_t, 3> shape = {8, 9, 10};
+    StaggeredGrid<Allocator<double>> in(shape), out(shape);
+    StaggeredGrid<Allocator<double>, UNorm16> in_quantized(shape),
+        out_quantized(shape);
+    fill_tilted_interface(in.volume_fraction);
+    fill_tilted_interface(in_quantized.volume_fraction);
+    VOF<Allocator>(2).step(in, out, 0, dt);
+    VOF<Allocator, WallBoundary, double, UNorm16>(2).step(
+        in_quantized, out_quantized, 0, dt);
+    for(const auto& idxs: in.volume_fraction.indices()) {
+        EXPECT_NEAR(out_quantized.volume_fraction[idxs],
+                    out.volume_fraction[idxs], 1e-4);
+        EXPECT_NEAR(out_quantized.pressure[idxs], out.pressure[idxs], 1e-4);
+    }
+    for(int dim = 0; dim < ndim; dim++) {
+        for(const auto& idxs: in.u[dim].indices())
+            EXPECT_NEAR(out_quantized.u[dim][idxs], out.u[dim][idxs], 1e-4);
+    }
+}
+
+TEST(VofTest, SkippingUniformBlocksKeepsTheResult) {
+    const double dt = 0.01;
+    // Not a multiple of the block size, and mostly empty
+    const std::array<std::size_t, 3> shape = {20, 18, 21};
+    StaggeredGrid<Allocator<double>> grids[4] = {shape, shape, shape, shape};
+    for(auto* grid: {&grids[0], &grids[2]}) {
+        for(const auto& [i, j, k]: grid->volume_fraction.indices()) {
+            grid->volume_fraction[i][j][k] =
+                i < 6 and k < 12 ? 1.0 : i == 6 and k < 12 ? 0.3 : 0.0;
+        }
+    }
+    const VOF<Allocator> skipping(2), scanning(2, {}, true, false);
+    auto *front = &grids[0], *back = &grids[1];
+    auto *reference_front = &grids[2], *reference_back = &grids[3];
+    for(int step = 0; step < 3; step++) {
+        skipping.step(*front, *back, 0, dt);
+        scanning.step(*reference_front, *reference_back, 0, dt);
+        EXPECT_GT(skipping.block_stats().skipped, 0);
+        EXPECT_EQ(scanning.block_stats().skipped, 0);
+        EXPECT_EQ(skipping.block_stats().blocks, 3 * 3 * 3 * 3);
+        for(const auto& idxs: front->volume_fraction.indices()) {
+            ASSERT_EQ(back->volume_fraction[idxs],
+                      reference_back->volume_fraction[idxs]);
+            ASSERT_EQ(back->pressure[idxs], reference_back->pressure[idxs]);
+        }
+        EXPECT_EQ(back->interface_cells, reference_back->interface_cells);
+
+        // The summary of the new state covers all of its cells
+        ASSERT_TRUE(back->blocks_valid);
+        const BlockSummary& blocks = back->blocks;
+        std::vector<double> low(blocks.nb_blocks(), 1),
+            high(blocks.nb_blocks(), 0);
+        for(const auto& idxs: back->volume_fraction.indices()) {
+            const std::size_t b = blocks.block_of(idxs);
+            low[b] = std::min(low[b], back->volume_fraction[idxs]);
+            high[b] = std::max(high[b], back->volume_fraction[idxs]);
+        }
+        for(std::size_t b = 0; b < blocks.nb_blocks(); b++) {
+            EXPECT_EQ(blocks.min_fraction(b), low[b]);
+            EXPECT_EQ(blocks.max_fraction(b), high[b]);
+        }
+        std::swap(front, back);
+        std::swap(reference_front, reference_back);
+    }
+}
+
+TEST(VofTest, AdaptiveTimeStepFollowsTheFastestFace) {
+    using Grid = StaggeredGrid<Allocator<double>>;
+    const std::array<std::size_t, 3> shape = {10, 8, 16};
+    const double cfl = VOF<Allocator>::cfl, g = 9.81;
+    Grid grid(shape);
+    const VOF<Allocator> scheme(2);
+    // From rest, gravity bounds the step along z: g dt^2 = cfl dz
+    const double gravity_dt = std::sqrt(cfl / 16 / g);
+    EXPECT_DOUBLE_EQ(scheme.max_stable_dt(grid), gravity_dt);
+    // Each axis against its own cells: |u| = 2 along y, 1/8 wide
+    grid.u[1][{3, 4, 5}] = -2.0;
+    const double stable_dt = cfl / 8 / 2.0;
+    ASSERT_LT(stable_dt, gravity_dt);
+    EXPECT_DOUBLE_EQ(scheme.max_stable_dt(grid), stable_dt);
+
+    // The world takes a step that turns out stable, up to its cap
+    World<Grid, 3> world(shape, 1.0, true), capped(shape, 1e-3, true);
+    world.reset(grid);
+    capped.reset(grid);
+    world.step(scheme);
+    capped.step(scheme);
+    EXPECT_LE(world.last_dt, stable_dt);
+    EXPECT_GT(world.last_dt, stable_dt / 4);
+    EXPECT_DOUBLE_EQ(world.t, world.last_dt);
+    EXPECT_TRUE(scheme.stable_step(world.grid(), world.last_dt));
+    EXPECT_EQ(capped.last_dt, 1e-3);
+    // Too long a step from the same state is not
+    Grid after(shape);
+    scheme.step(grid, after, 0, 4 * stable_dt);
+    EXPECT_FALSE(scheme.stable_step(after, 4 * stable_dt));
+}
+
+TEST(VofTest, WorldMultiStepMatchesSteps) {
+    using Grid = StaggeredGrid<Allocator<double>>;
+    const std::array<std::size_t, 3> shape = {6, 7, 8};
+    Grid initial(shape);
+    fill_tilted_interface(initial.volume_fraction);
+    const VOF<Allocator> scheme(2);
+    // An odd number of steps ends in the other grid
+    World<Grid, 3> stepped(shape), multi_stepped(shape);
+    stepped.reset(initial);
+    multi_stepped.reset(initial);
+    for(int n = 0; n < 3; n++) stepped.step(scheme);
+    multi_stepped.multi_step(3, scheme);
+    EXPECT_DOUBLE_EQ(multi_stepped.t, stepped.t);
+    for(const auto& idxs: initial.volume_fraction.indices()) {
+        EXPECT_EQ(multi_stepped.grid().volume_fraction[idxs],
+                  stepped.grid().volume_fraction[idxs]);
+    }
+}
+
+TEST(VofTest, EnsembleMatchesSeparateRuns) {
+    using Grid = StaggeredGrid<Allocator<double>>;
+    std::istringstream file("# name size steps timestep\n"
+                            "small 8 3 0.01\n"
+                            "\n"
+                            "large 10 2 0.02\n"
+                            "long 8 5 0.01 unused.npy\n"
+                            "dense 8 3 0.01 - 1001\n");
+    const auto cases = read_ensemble_cases(file);
+    ASSERT_EQ(cases.size(), 4);
+    EXPECT_EQ(cases[1].name, "large");
+    EXPECT_EQ(cases[1].grid_size, 10);
+    EXPECT_EQ(cases[2].steps, 5);
+    EXPECT_EQ(cases[2].input, "unused.npy");
+    EXPECT_EQ(cases[2].density_ratio, 101);
+    EXPECT_EQ(cases[3].input, "");
+    EXPECT_EQ(cases[3].density_ratio, 1001);
+    std::istringstream invalid("light 8 3 0.01 - 0.5\n");
+    EXPECT_THROW(read_ensemble_cases(invalid), std::runtime_error);
+
+    std::vector<Grid> initial_grids;
+    for(const auto& ensemble_case: cases) {
+        const std::size_t size = ensemble_case.grid_size;
+        Grid& grid = initial_grids.emplace_back(
+            std::array<std::size_t, 3>{size, size, size});
+        fill_tilted_interface(grid.volume_fraction);
+    }
+    std::ostringstream log;
+    const auto results = run_ensemble<VOF<Allocator>>(
+        cases, [&](std::size_t n) -> const Grid& { return initial_grids[n]; },
+        2, false, {.log = &log});
+    ASSERT_EQ(results.size(), cases.size());
+
+    // One solve per step, grouped by case in their order
+    std::istringstream log_lines(log.str());
+    std::string line;
+    for(const auto& ensemble_case: cases) {
+        for(unsigned int i = 0; i < ensemble_case.steps; i++) {
+            ASSERT_TRUE(std::getline(log_lines, line));
+            EXPECT_EQ(line.substr(0, line.find(',')), ensemble_case.name);
+        }
+    }
+    EXPECT_FALSE(std::getline(log_lines, line));
+
+    // The schemes reused from case to case give the same result as new ones
+    for(std::size_t n = 0; n < cases.size(); n++) {
+        const std::size_t size = cases[n].grid_size;
+        World<Grid, 3> world({size, size, size}, cases[n].time_step);
+        world.reset(initial_grids[n]);
+        const VOF<Allocator> scheme(
+            1, {.light_density =
+                    light_density_of_ratio(cases[n].density_ratio)});
+        for(unsigned int i = 0; i < cases[n].steps; i++) world.step(scheme);
+        double mass = 0;
+        for(const auto& idxs: world.grid().volume_fraction.indices())
+            mass += world.grid().volume_fraction[idxs];
+        EXPECT_EQ(results[n].steps, cases[n].steps);
+        EXPECT_DOUBLE_EQ(results[n].t, world.t);
+        EXPECT_EQ(results[n].mass, mass);
+    }
+}